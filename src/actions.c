@@ -23,6 +23,7 @@
 #include "support.h"
 #include "version.h"
 #include <limits.h>
+#include <fnmatch.h>
 
 /* ne's temporary file name template for the THROUGH command. */
 
@@ -95,11 +96,15 @@ int do_action(buffer *b, action a, int64_t c, char *p) {
 	assert(b->encoding != ENC_UTF8 || b->cur_pos >= b->cur_line_desc->line_len || utf8len(b->cur_line_desc->line[b->cur_pos]) > 0);
 	assert(b != cur_buffer || b->cur_x < ne_columns);
 	assert(b != cur_buffer || b->cur_y < ne_lines - 1);
+
+	/* The initial syntax state of the current line must be valid. */
+	ensure_syntax_states(b, b->cur_line + 1);
+
 #ifndef NDEBUG
 	if (b->syn && b->attr_len != -1) {
 		HIGHLIGHT_STATE next_state = parse(b->syn, b->cur_line_desc, b->cur_line_desc->highlight_state, b->encoding == ENC_UTF8);
 		assert(attr_len == b->attr_len);
-		assert(memcmp(attr_buf, b->attr_buf, attr_len) == 0);
+		assert(attr_equal(&attr_buf, &b->attr_buf, attr_len));
 		assert(memcmp(&next_state, &b->next_state, sizeof next_state) == 0);
 	}
 #endif
@@ -437,6 +442,12 @@ int do_action(buffer *b, action a, int64_t c, char *p) {
 		b->opt.automatch = c;
 		return OK;
 
+	case HIGHLIGHTMATCHES_A:
+		if (c < 0 && (c = request_number(b, "Highlight mode (sum of 0:none, 1:brightness, 2:inverse, 4:bold, 8:underline)", b->opt.highlight_matches)) < 0 || c > 15) return ((c) == ABORT ? OK : INVALID_MATCH_MODE);
+		b->opt.highlight_matches = c;
+		reset_window();
+		return OK;
+
 	case INSERTTAB_A:
 		recording = b->recording;
 		b->recording = 0;
@@ -587,8 +598,9 @@ int do_action(buffer *b, action a, int64_t c, char *p) {
 				if (col > 1 && (b->win_x + b->cur_x + col) % b->opt.tab_size == 0) {
 					if (b->syn) {
 						ensure_attributes(b);
-						memmove(b->attr_buf + b->cur_char + 1, b->attr_buf + b->cur_char + col, b->attr_len - (b->cur_char + col));
-						b->attr_buf[b->cur_char] = -1;
+						attr_truncate(&b->attr_buf, b->attr_len);
+						attr_delete(&b->attr_buf, b->cur_char + 1, col - 1);
+						attr_fill(&b->attr_buf, b->cur_char, 1, -1);
 						b->attr_len -= (col - 1);
 					}
 					delete_stream(b, b->cur_line_desc, b->cur_line, b->cur_pos, col);
@@ -617,7 +629,7 @@ int do_action(buffer *b, action a, int64_t c, char *p) {
 			if (b->cur_pos < b->cur_line_desc->line_len) {
 				/* Deletion inside a line. */
 				const int old_char = b->encoding == ENC_UTF8 ? utf8char(&b->cur_line_desc->line[b->cur_pos]) : b->cur_line_desc->line[b->cur_pos];
-				const uint32_t old_attr = b->syn ? b->attr_buf[b->cur_pos] : 0;
+				const uint32_t old_attr = b->syn ? attr_at(&b->attr_buf, b->cur_char, NULL) : 0;
 				if (b->syn) {
 					/* Invalidate attrs beyond the right window edge. */
 					const int64_t right_char = calc_char_len(b->cur_line_desc, calc_pos(b->cur_line_desc, b->win_x + ne_columns, b->opt.tab_size, b->encoding), b->encoding);
@@ -858,10 +870,11 @@ int do_action(buffer *b, action a, int64_t c, char *p) {
 					change_filename(b, p);
 					b->syn = NULL; /* So that autoprefs will load the right syntax. */
 					if (b->opt.auto_prefs) {
-						if (b->allocated_chars - b->free_chars <= MAX_SYNTAX_SIZE) {
+						if (b->allocated_chars - b->free_chars <= MAX_SYNTAX_SIZE || sync_lines) {
 							if (load_auto_prefs(b, NULL) == HAS_NO_EXTENSION)
 								load_auto_prefs(b, DEF_PREFS_NAME);
 							reset_syntax_states(b);
+							if (b->windowed_syntax && error == OK) error = FILE_TOO_LARGE_SYNTAX_HIGHLIGHTING_APPROXIMATE;
 						}
 						else if (error == OK) error = FILE_TOO_LARGE_SYNTAX_HIGHLIGHTING_DISABLED;
 					}
@@ -908,6 +921,52 @@ int do_action(buffer *b, action a, int64_t c, char *p) {
 
 		return error ? ERROR : 0;
 
+	case GREP_A:
+	case GREPREGEXP_A: ;
+		/* The path is requested only if the pattern is, and never within a
+			macro: otherwise, we search the current directory. */
+		const bool request_path = p == NULL && !b->executing_macro && !b->executing_internal_macro;
+		if (p || (p = request_string(b, a == GREP_A ? "Grep" : "Grep RegExp", b->find_string, false, COMPLETE_NONE, b->encoding == ENC_UTF8 || b->encoding == ENC_ASCII && b->opt.utf8auto))) {
+			if (q = request_path ? request_string(b, "Grep in", ".", false, COMPLETE_FILE, b->encoding == ENC_UTF8 || b->encoding == ENC_ASCII && b->opt.utf8auto) : str_dup(".")) {
+				int64_t matches, files;
+				error = grep(b, p, q, a == GREPREGEXP_A, &matches, &files);
+				free(q);
+				free(p);
+				if (error) return error;
+				if (!matches) {
+					print_message("No matches.");
+					return ERROR;
+				}
+				reset_window();
+				snprintf(msg, MAX_MESSAGE_SIZE, "%" PRId64 " match%s in %" PRId64 " file%s.", matches, matches > 1 ? "es" : "", files, files > 1 ? "s" : "");
+				print_message(msg);
+				return OK;
+			}
+			free(p);
+		}
+		return ERROR;
+
+	case OPENMATCH_A: ;
+		int64_t match_line;
+		if (!(p = parse_grep_match(b->cur_line_desc, &match_line))) return NOT_A_GREP_MATCH;
+
+		if (b = get_buffer_named(p)) {
+			free(p);
+			cur_buffer = b;
+			need_attr_update = false;
+			b->attr_len = -1;
+		}
+		else {
+			if (error = do_action(cur_buffer, OPENNEW_A, 0, p)) return error;
+			b = cur_buffer;
+		}
+
+		if (match_line == 0 || match_line > b->num_lines) match_line = b->num_lines;
+		goto_line(b, match_line - 1);
+		keep_cursor_on_screen(b);
+		reset_window();
+		return OK;
+
 	case REPLACE_A:
 	case REPLACEONCE_A:
 	case REPLACEALL_A:
@@ -1021,6 +1080,88 @@ int do_action(buffer *b, action a, int64_t c, char *p) {
 		}
 		return ERROR;
 
+	case REPLACEALLDOCS_A: ;
+		/* As for Grep, the documents are requested only if the replacement is,
+			and never within a macro: otherwise, all documents are searched. */
+		const bool request_docs = p == NULL && !b->executing_macro && !b->executing_internal_macro;
+		if ((q = b->find_string) || (q = request_string(b, b->last_was_regexp ? "Find RegExp" : "Find", NULL, false, COMPLETE_NONE, b->encoding == ENC_UTF8 || b->encoding == ENC_ASCII && b->opt.utf8auto))) {
+			if (q != b->find_string) {
+				free(b->find_string);
+				b->find_string = q;
+				b->find_string_changed = 1;
+			}
+
+			if (p || (p = request_string(b, b->last_was_regexp ? "Replace RegExp" : "Replace", b->replace_string, true, COMPLETE_NONE, b->encoding == ENC_UTF8 || b->encoding == ENC_ASCII && b->opt.utf8auto))) {
+				const encoding_type search_encoding = detect_encoding(b->find_string, strlen(b->find_string));
+				const encoding_type replace_encoding = detect_encoding(p, strlen(p));
+
+				free(b->replace_string);
+				b->replace_string = p;
+				b->last_was_replace = 1;
+
+				if (search_encoding != ENC_ASCII && replace_encoding != ENC_ASCII && search_encoding != replace_encoding) return INCOMPATIBLE_REPLACE_STRING_ENCODING;
+				if (!(q = request_docs ? request_string(b, "Documents", "*", false, COMPLETE_NONE, false) : str_dup("*"))) return ERROR;
+
+				/* Every matching document gets its own undo chain; the screen is
+					updated only at the end. Read-only documents and documents with an
+					incompatible encoding are skipped. */
+
+				char summary[MAX_MESSAGE_SIZE] = "";
+				int64_t total_replace = 0, num_docs = 0;
+				int summary_len = 0;
+
+				delay_update();
+				stop = false;
+				error = OK;
+
+				for(buffer *rb = (buffer *)buffers.head; rb->b_node.next && !error; rb = (buffer *)rb->b_node.next) {
+					if (rb->opt.read_only || fnmatch(q, rb->filename ? rb->filename : "", 0)) continue;
+					if (search_encoding != ENC_ASCII && rb->encoding != ENC_ASCII && search_encoding != rb->encoding ||
+						replace_encoding != ENC_ASCII && rb->encoding != ENC_ASCII && replace_encoding != rb->encoding) continue;
+
+					if (rb != b) {
+						char * const find_string = str_dup(b->find_string), * const replace_string = str_dup(b->replace_string);
+						if (!find_string || !replace_string) {
+							free(find_string);
+							free(replace_string);
+							error = OUT_OF_MEMORY;
+							break;
+						}
+						free(rb->find_string);
+						free(rb->replace_string);
+						rb->find_string = find_string;
+						rb->replace_string = replace_string;
+						rb->last_was_regexp = b->last_was_regexp;
+						rb->last_was_replace = 1;
+					}
+
+					int64_t num_replace;
+					error = replace_all(rb, &num_replace);
+
+					if (num_replace) {
+						total_replace += num_replace;
+						num_docs++;
+						if (summary_len < sizeof summary) summary_len += snprintf(summary + summary_len, sizeof summary - summary_len, "%s%s: %" PRId64, summary_len ? ", " : "", rb->filename ? file_part(rb->filename) : "<unnamed>", num_replace);
+					}
+				}
+
+				free(q);
+				reset_window();
+
+				if (total_replace) {
+					snprintf(msg, MAX_MESSAGE_SIZE, "%" PRId64 " replacement%s in %" PRId64 " document%s (%s).", total_replace, total_replace > 1 ? "s" : "", num_docs, num_docs > 1 ? "s" : "", summary);
+					print_message(msg);
+				}
+				else if (!error) {
+					print_message("No replacements made.");
+					return ERROR;
+				}
+
+				return error;
+			}
+		}
+		return ERROR;
+
 	case REPEATLAST_A:
 		if (b->opt.read_only && b->last_was_replace) return DOCUMENT_IS_READ_ONLY;
 		if (!b->find_string) return NO_SEARCH_STRING;
@@ -1116,6 +1257,11 @@ int do_action(buffer *b, action a, int64_t c, char *p) {
 		turbo = c;
 		return OK;
 
+	case SYNCLINES_A:
+		if ((int)c < 0 && (int)(c = request_number(b, "Sync Lines", sync_lines)) < 0) return NUMERIC_ERROR(c);
+		sync_lines = c;
+		return OK;
+
 	case CLIPNUMBER_A:
 		if ((int)c < 0 && (int)(c = request_number(b, "Clip Number", b->opt.cur_clip)) < 0) return NUMERIC_ERROR(c);
 		b->opt.cur_clip = c;
@@ -34,10 +34,20 @@ void setup_ansi_term(void) {
 
 #ifdef TERMCAP
 	ne_cursor_address = "\x1b[%i%d;%dH";
+	ne_column_address = "\x1b[%i%dG";
+	ne_parm_right_cursor = "\x1b[%dC";
+	ne_parm_down_cursor = "\x1b[%dB";
+	ne_parm_left_cursor = "\x1b[%dD";
+	ne_parm_up_cursor = "\x1b[%dA";
 	ne_set_background = "\x1b[4%dm";
 	ne_set_foreground = "\x1b[3%dm";
 #else
 	ne_cursor_address = "\x1b[%i%p1%d;%p2%dH";
+	ne_column_address = "\x1b[%i%p1%dG";
+	ne_parm_right_cursor = "\x1b[%p1%dC";
+	ne_parm_down_cursor = "\x1b[%p1%dB";
+	ne_parm_left_cursor = "\x1b[%p1%dD";
+	ne_parm_up_cursor = "\x1b[%p1%dA";
 	ne_set_background = "\x1b[4%p1%dm";
 	ne_set_foreground = "\x1b[3%p1%dm";
 #endif
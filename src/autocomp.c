@@ -54,7 +54,11 @@ static void add_string(const char * const s, const int len, const int ext) {
 	req_list_add(&rl, buf, ext);
 }
 
-static void search_buff(const buffer *b, char * p, const int encoding, const bool case_search, const int ext) {
+/* Adds to the completion list the words of b starting with p. b_encoding
+   is the encoding of b, and it is always a compile-time constant (see
+   search_buff()). */
+
+static void inline search_buff_enc(const buffer *b, char * p, const int encoding, const bool case_search, const int ext, const encoding_type b_encoding) {
 	assert(p);
 	const int p_len = strlen(p);
 
@@ -62,20 +66,20 @@ static void search_buff(const buffer *b, char * p, const int encoding, const boo
 		int64_t l = 0, r = 0;
 		do {
 			/* find left edge of word */
-			while (l < ld->line_len - p_len && !ne_isword(get_char(&ld->line[l], b->encoding), b->encoding)) l += get_char_width(&ld->line[l], b->encoding);
+			while (l < ld->line_len - p_len && !ne_isword(get_char(&ld->line[l], b_encoding), b_encoding)) l = next_pos(ld->line, l, b_encoding);
 			if (l < ld->line_len - p_len ) {
 				int ch;
 				/* find right edge of word */
-				r = l + get_char_width(&ld->line[l], b->encoding);
+				r = next_pos(ld->line, l, b_encoding);
 				/* accept "'" as a word character if it is followed by another word character, so that
 				   words like "don't" are not broken into "don" and "t". */
 				while (r < ld->line_len
-				       && (    ne_isword(ch=get_char(&ld->line[r], b->encoding), b->encoding)
-				            || ( r+1 < ld->line_len && ch == '\'' && ne_isword(get_char(&ld->line[r+1], b->encoding), b->encoding))
+				       && (    ne_isword(ch=get_char(&ld->line[r], b_encoding), b_encoding)
+				            || ( r+1 < ld->line_len && ch == '\'' && ne_isword(get_char(&ld->line[r+1], b_encoding), b_encoding))
 				          )
-				      ) r += get_char_width(&ld->line[r], b->encoding);
+				      ) r = next_pos(ld->line, r, b_encoding);
 				if (r - l > p_len && !(case_search ? strncmp : strncasecmp)(p, &ld->line[l], p_len)) {
-					if (b->encoding == encoding || is_ascii(&ld->line[l], r - l)) add_string(&ld->line[l], r - l, ext);
+					if (b_encoding == encoding || is_ascii(&ld->line[l], r - l)) add_string(&ld->line[l], r - l, ext);
 				}
 				l = r;
 				count_scanned++;
@@ -90,6 +94,10 @@ static void search_buff(const buffer *b, char * p, const int encoding, const boo
 	add_string(NULL, -1, 0);
 }
 
+static void search_buff(const buffer *b, char * p, const int encoding, const bool case_search, const int ext) {
+	SPECIALIZE_ENCODING(b->encoding, search_buff_enc, b, p, encoding, case_search, ext);
+}
+
 /* Returns a completion for the (non-NULL) prefix p, showing suffixes from
    all buffers if ext is true. Note that p is free()'d by this function,
    and that, in turn, the returned string must be free()'d by the caller
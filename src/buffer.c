@@ -176,6 +176,8 @@ line_desc_pool *alloc_line_desc_pool_from_memory(void *pool, int64_t pool_size)
 void free_line_desc_pool(line_desc_pool * const ldp) {
 	if (ldp == NULL) return;
 	assert_line_desc_pool(ldp);
+	line_index_flush();
+	line_matches_flush();
 	if (ldp->mapped) munmap(ldp->pool, ldp->size * (do_syntax ? sizeof(line_desc) : sizeof(no_syntax_line_desc)));
 	else free(ldp->pool);
 	free(ldp);
@@ -220,6 +222,7 @@ buffer *alloc_buffer(const buffer * const cur_b) {
 			b->opt.del_tabs       = cur_b->opt.del_tabs;
 			b->opt.shift_tabs     = cur_b->opt.shift_tabs;
 			b->opt.automatch      = cur_b->opt.automatch;
+			b->opt.highlight_matches = cur_b->opt.highlight_matches;
 			b->opt.right_margin   = cur_b->opt.right_margin;
 
 			b->opt.free_form      = cur_b->opt.free_form;
@@ -262,6 +265,8 @@ void free_buffer_contents(buffer * const b) {
 	free_list(&b->char_pool_list, free_char_pool);
 	new_list(&b->line_desc_list);
 	b->cur_line_desc = b->top_line_desc = NULL;
+	b->syn_valid_ld = b->syn_resume_ld = NULL;
+	b->syn_resume = 0;
 
 	b->allocated_chars = b->free_chars = 0;
 	b->num_lines = 0;
@@ -320,7 +325,7 @@ void free_buffer(buffer * const b) {
 	free(b->find_string);
 	free(b->replace_string);
 	free(b->command_line);
-	if (b->attr_buf) free(b->attr_buf);
+	free(b->attr_buf.span);
 	free(b);
 }
 
@@ -426,6 +431,8 @@ line_desc *alloc_line_desc(buffer * const b) {
 
 			ldp->allocated_items++;
 
+			line_index_invalidate(ld, 0);
+			line_matches_invalidate(ld);
 			ld->line = NULL;
 			ld->line_len = 0;
 			if (do_syntax) ld->highlight_state.state = -1;
@@ -473,6 +480,8 @@ void free_line_desc(buffer * const b, line_desc * const ld) {
 
 	block_signals();
 
+	line_index_invalidate(ld, 0);
+	line_matches_invalidate(ld);
 	add_head(&ldp->free_list, &ld->ld_node);
 
 	if (--ldp->allocated_items == 0) {
@@ -715,6 +724,18 @@ void delete_to_eol(buffer * const b, line_desc * const ld, const int64_t line, c
 
 
 
+/* Must be called before modifying the given line. The states computed
+   before the watermark was moved back (see ensure_syntax_states()) cannot be
+   reused starting from a modified line. Note that lines before the watermark
+   are handled by update_syntax_states(). */
+
+static void limit_syntax_resume(buffer * const b, line_desc * const ld, const int64_t line) {
+	if (line < b->syn_valid || line >= b->syn_resume) return;
+	b->syn_resume = line;
+	b->syn_resume_ld = ld;
+}
+
+
 /* Inserts a stream in a line at a given position.  The position has to be
    smaller or equal to the line length. Since the stream can contain many
    lines, this function can be used for manipulating all insertions. It also
@@ -739,6 +760,8 @@ int insert_stream(buffer * const b, line_desc * ld, int64_t line, int64_t pos, c
 		}
 	}
 
+	limit_syntax_resume(b, ld, line);
+
 	const char *s = stream;
 	while(s - stream < stream_len) {
 		int64_t const len = strnlen_ne(s, stream_len - (s - stream));
@@ -791,6 +814,8 @@ int insert_stream(buffer * const b, line_desc * ld, int64_t line, int64_t pos, c
 				}
 			}
 			b->is_modified = 1;
+			line_index_invalidate(ld, pos);
+			line_matches_invalidate(ld);
 
 			/* We just inserted len chars at (line,pos); adjust bookmarks and mark accordingly. */
 			if (b->marking && b->block_start_line == line && b->block_start_pos > pos) b->block_start_pos += len;
@@ -809,12 +834,17 @@ int insert_stream(buffer * const b, line_desc * ld, int64_t line, int64_t pos, c
 
 				add(&new_ld->ld_node, &ld->ld_node);
 				b->num_lines++;
+				if (line < b->syn_valid) b->syn_valid++;
+				if (line < b->syn_resume) b->syn_resume++;
+				if (line < b->syn_window_start) b->syn_window_start++;
 
 				if (pos + len < ld->line_len) {
 					new_ld->line_len = ld->line_len - pos - len;
 					new_ld->line = &ld->line[pos + len];
 					ld->line_len = pos + len;
 					if (pos + len == 0) ld->line = NULL;
+					line_index_invalidate(ld, pos + len);
+					line_matches_invalidate(ld);
 				}
 
 				b->is_modified = 1;
@@ -919,6 +949,8 @@ int delete_stream(buffer * const b, line_desc * const ld, const int64_t line, co
 		}
 	}
 
+	limit_syntax_resume(b, ld, line);
+
 	while(len) {
 		/* First case: we are just on the end of a line. We join the current
 		line with the following one (if it's there of course). If, however,
@@ -1000,6 +1032,11 @@ int delete_stream(buffer * const b, line_desc * const ld, const int64_t line, co
 
 			ld->line_len += next_ld->line_len;
 			b->num_lines--;
+			if (next_ld == b->syn_valid_ld) b->syn_valid_ld = (line_desc *)next_ld->ld_node.next;
+			else if (line + 1 < b->syn_valid) b->syn_valid--;
+			if (next_ld == b->syn_resume_ld) b->syn_resume_ld = (line_desc *)next_ld->ld_node.next;
+			else if (line + 1 < b->syn_resume) b->syn_resume--;
+			if (line + 1 < b->syn_window_start) b->syn_window_start--;
 
 			rem(&next_ld->ld_node);
 			free_line_desc(b, next_ld);
@@ -1061,6 +1098,8 @@ int delete_stream(buffer * const b, line_desc * const ld, const int64_t line, co
 			assert_line_desc(ld, b->encoding);
 		}
 		b->is_modified = 1;
+		line_index_invalidate(ld, pos);
+		line_matches_invalidate(ld);
 	}
 
 	if (b->opt.do_undo && !(b->undoing || b->redoing)) fix_last_undo_step(b, -len);
@@ -1477,37 +1516,26 @@ int load_fd_in_buffer(buffer *b, int fd) {
 	return OK;
 }
 
-/* Recomputes initial states for all lines in a buffer. */
+/* Invalidates the initial states of all lines in a buffer but the first one.
+   States are then recomputed lazily by ensure_syntax_states(), as lines are
+   displayed or edited, and in the background while waiting for input. Buffers
+   larger than MAX_SYNTAX_SIZE are highlighted in windowed mode, if enabled. */
 
 void reset_syntax_states(buffer *b) {
-	if (b->syn) {
-		HIGHLIGHT_STATE next_line_state = { 0, 0, "" };
-		for(line_desc *ld = (line_desc *)b->line_desc_list.head; ld->ld_node.next; ld = (line_desc *)ld->ld_node.next) {
-			ld->highlight_state = next_line_state;
-			next_line_state = parse(b->syn, ld, next_line_state, b->encoding == ENC_UTF8);
-		}
-
+	if (b->syn && b->line_desc_list.head->next) {
+		line_desc * const ld = (line_desc *)b->line_desc_list.head;
+		const HIGHLIGHT_STATE initial_state = { 0, 0, "" };
+		ld->highlight_state = initial_state;
+		b->windowed_syntax = sync_lines > 0 && b->allocated_chars - b->free_chars > MAX_SYNTAX_SIZE;
+		b->syn_window_start = 0;
+		b->syn_valid = 1;
+		b->syn_valid_ld = (line_desc *)ld->ld_node.next;
+		b->syn_resume = 0;
 		b->attr_len = -1;
 	}	
 }
 
 
-/* Ensures that the attribute buffer of this buffer is large enough. */
-
-void ensure_attr_buf(buffer * const b, const int64_t capacity) {
-	if (capacity == 0) return;
-	/* attr_buf already exists? */
-	if (!b->attr_buf) {
-		b->attr_size = capacity;
-		b->attr_buf = malloc(b->attr_size * sizeof *b->attr_buf); 
-	}
-	else if (capacity > b->attr_size) {
-		b->attr_size = capacity;
-		b->attr_buf = realloc(b->attr_buf, b->attr_size * sizeof *b->attr_buf);
-	}
-}
-
-
 /* Here we save a buffer to a given file. If no file is specified, the
    buffer filename field is used. The is_modified flag is set to 0,
    and the mtime is updated. */
@@ -360,6 +360,83 @@ int paste_to_buffer(buffer *b, int n) {
 
 
 
+/* Inserts at the cursor position the text of a bracketed paste (see
+   read_paste()) as a single undo step, with no auto-indent or word wrap, and
+   moves the cursor after it. Line breaks (CR, LF or CR LF) become the NULs
+   separating lines in a stream, and NULs are discarded; the text is modified
+   in place. As it happens with typed characters, if the encoding of the text
+   differs from that of the buffer the text is converted: 8-bit characters
+   become UTF-8 sequences, and UTF-8 characters become 8-bit characters, if
+   possible. When recording, the paste is recorded as InsertString and
+   InsertLine commands. */
+
+int insert_paste(buffer * const b, char *p, const int64_t len) {
+	if (b->opt.read_only) return DOCUMENT_IS_READ_ONLY;
+
+	int64_t n = 0, breaks = 0, last_start = 0;
+	for(int64_t i = 0; i < len; i++) {
+		if (p[i] == '\r' || p[i] == '\n') {
+			if (p[i] == '\r' && i + 1 < len && p[i + 1] == '\n') i++;
+			p[n++] = 0;
+			breaks++;
+			last_start = n;
+		}
+		else if (p[i]) p[n++] = p[i];
+	}
+	p[n] = 0;
+	if (n == 0) return OK;
+
+	const encoding_type encoding = detect_encoding(p, n);
+	char *converted = NULL;
+	if (b->encoding == ENC_UTF8 && encoding == ENC_8_BIT || b->encoding == ENC_8_BIT && encoding == ENC_UTF8) {
+		int64_t m = 0;
+		if (b->encoding == ENC_UTF8) {
+			if (!(converted = malloc(2 * n + 1))) return OUT_OF_MEMORY;
+			for(int64_t i = 0; i < n; i++) m += utf8str((unsigned char)p[i], converted + m);
+			p = converted;
+		}
+		else {
+			for(int64_t i = 0; i < n;) {
+				const int c = utf8char(p + i);
+				if (c > 0xFF) return INCOMPATIBLE_PASTE_ENCODING;
+				i = next_pos(p, i, ENC_UTF8);
+				p[m++] = c;
+			}
+		}
+		p[n = m] = 0;
+		/* The positions of the line starts have changed. */
+		last_start = 0;
+		for(int64_t i = 0; i < n; i++) if (!p[i]) last_start = i + 1;
+	}
+	if (b->encoding == ENC_ASCII) b->encoding = encoding;
+
+	if (b->recording) {
+		for(int64_t i = 0; i <= n; i += strlen(p + i) + 1) {
+			if (p[i]) record_action(b->cur_macro, INSERTSTRING_A, -1, p + i, verbose_macros);
+			if (i + strlen(p + i) < n) record_action(b->cur_macro, INSERTLINE_A, -1, NULL, verbose_macros);
+		}
+	}
+
+	line_desc * const ld = b->cur_line_desc, * const end_ld = (line_desc *)b->cur_line_desc->ld_node.next;
+
+	start_undo_chain(b);
+	if (b->cur_pos > ld->line_len)
+		insert_spaces(b, ld, b->cur_line, ld->line_len, b->win_x + b->cur_x - calc_width(ld, ld->line_len, b->opt.tab_size, b->encoding));
+
+	const int error = insert_stream(b, ld, b->cur_line, b->cur_pos, p, n);
+	end_undo_chain(b);
+	free(converted);
+	if (error) return error;
+
+	assert(ld == b->cur_line_desc);
+	update_syntax_and_lines(b, ld, end_ld);
+	update_window_lines(b, b->cur_line_desc, b->cur_y, ne_lines - 2, false);
+	goto_line_pos(b, b->cur_line + breaks, breaks ? n - last_start : b->cur_pos + n);
+	return OK;
+}
+
+
+
 /* Works like copy_to_clip(), but the region to copy is the rectangle defined
    by the cursor and the marker. Same comments apply. Note that in case of a
    cut we use start_undo_chain() in order to make the various deletions a
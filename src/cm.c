@@ -33,6 +33,7 @@
 #endif
 
 #include "cm.h"
+#include "term.h"
 
 #define	BIG	9999
 
@@ -53,7 +54,7 @@ int evalcost (int c) {
 /* This function is used in tputs(). */
 
 int cmputc (int c) {
-	return putchar(c & 0x7f);
+	return ne_putchar(c & 0x7f);
 }
 
 
@@ -69,14 +70,49 @@ int cmputc (int c) {
 void cmcheckmagic () {
 	if (curX == ScreenCols) {
 		assert(MagicWrap && curY < ScreenRows - 1);
-		putchar ('\r');
-		putchar ('\n');
+		ne_putchar('\r');
+		ne_putchar('\n');
 		curX = 0;
 		curY++;
 	}
 }
 
 
+/* The parameterized motions. */
+
+enum { PARM_UP, PARM_DOWN, PARM_LEFT, PARM_RIGHT, PARM_COL, PARM_ROW, NUM_PARMS };
+
+#define MAX_PARM_COST 1024
+
+/* The costs of parameterized motions, computed lazily (0 means unknown). */
+
+static int parm_costs[NUM_PARMS][MAX_PARM_COST];
+
+static char *parm_string(const int parm, const int n) {
+	switch(parm) {
+		case PARM_UP:    return Wcm.cm_multiup ? tparm(Wcm.cm_multiup, n) : NULL;
+		case PARM_DOWN:  return Wcm.cm_multidown ? tparm(Wcm.cm_multidown, n) : NULL;
+		case PARM_LEFT:  return Wcm.cm_multileft ? tparm(Wcm.cm_multileft, n) : NULL;
+		case PARM_RIGHT: return Wcm.cm_multiright ? tparm(Wcm.cm_multiright, n) : NULL;
+		case PARM_COL:   return Wcm.cm_habs ? tgoto(Wcm.cm_habs, 0, n) : NULL;
+		case PARM_ROW:   return Wcm.cm_vabs ? tgoto(Wcm.cm_vabs, 0, n) : NULL;
+	}
+	return NULL;
+}
+
+static int parm_cost(const int parm, const int n) {
+	if (n < MAX_PARM_COST && parm_costs[parm][n]) return parm_costs[parm][n];
+	const char * const p = parm_string(parm, n);
+	if (p) {
+		cost = 0;
+		tputs(p, 1, evalcost);
+	}
+	else cost = BIG;
+	if (n < MAX_PARM_COST) parm_costs[parm][n] = cost;
+	return cost;
+}
+
+
 /* (Re)Initialises the cost factors, given the output speed of the terminal in
    the variable ospeed.  (Note: this holds B300, B9600, etc -- ie stuff out of
    <sgtty.h>.) */
@@ -106,6 +142,8 @@ void cmcostinit () {
 	Wcm.cc_abs =  CMCOST (Wcm.cm_abs, evalcost);
 	Wcm.cc_habs = CMCOST (Wcm.cm_habs, evalcost);
 	Wcm.cc_vabs = CMCOST (Wcm.cm_vabs, evalcost);
+
+	memset(parm_costs, 0, sizeof parm_costs);
 	
 #undef CMCOST
 #undef COST
@@ -113,12 +151,13 @@ void cmcostinit () {
 
 
 /* Calculates the cost to move from (srcy, srcx) to (dsty, dstx) using up and
- down, and left and right, motions, and tabs.  If doit is set actually perform
- the motion. */
+ down, and left and right, motions (possibly parameterized), tabs, column or
+ row absolute motions, and rewriting the characters already on the screen.
+ If doit is set actually perform the motion. */
 
 static int calccost (int srcy, int srcx, int dsty, int dstx, int doit) {
 	register int	 deltay, deltax, c, totalcost;
-	int ntabs, n2tabs, tabx, tab2x, tabcost;
+	int ntabs, n2tabs, tabx, tab2x, tabcost, parm, best;
 	register char  *p;
 	
 	/* If have just wrapped on a terminal with xn, don't believe the cursor
@@ -129,18 +168,36 @@ static int calccost (int srcy, int srcx, int dsty, int dstx, int doit) {
 	totalcost = 0;
 	if ((deltay = dsty - srcy) == 0) goto x;
 
-	if (deltay < 0) p = Wcm.cm_up, c = Wcm.cc_up, deltay = -deltay;
-	else p = Wcm.cm_down, c = Wcm.cc_down;
+	if (deltay < 0) p = Wcm.cm_up, c = Wcm.cc_up, deltay = -deltay, parm = PARM_UP;
+	else p = Wcm.cm_down, c = Wcm.cc_down, parm = PARM_DOWN;
 
-	if (c == BIG) {		/* caint get thar from here */
+	/* We pick the cheapest among single motions, a parameterized motion and
+		a row absolute motion. */
+	best = c < BIG ? c * deltay : BIG;
+	if (parm_cost(parm, deltay) < best) best = parm_cost(parm, deltay);
+	else parm = -1;
+	if (parm_cost(PARM_ROW, dsty) < best) best = parm_cost(PARM_ROW, dsty), parm = PARM_ROW;
+
+	if (best >= BIG) {		/* caint get thar from here */
 		if (doit) printf ("OOPS");
-		return c;
+		return BIG;
 	}
 
-	totalcost = c * deltay;
-	if (doit) while (deltay-- != 0) tputs (p, 1, cmputc);
+	totalcost = best;
+	if (doit) {
+		if (parm == -1) while (deltay-- != 0) tputs (p, 1, cmputc);
+		else tputs (parm_string(parm, parm == PARM_ROW ? dsty : deltay), 1, cmputc);
+	}
 x: 
 	if ((deltax = dstx - srcx) == 0)	goto done;
+
+	/* Parameterized motions, column absolute motions and rewriting are
+		alternatives to the single motions (and tabs) we compute below. */
+	parm = deltax < 0 ? PARM_LEFT : PARM_RIGHT;
+	best = parm_cost(parm, deltax < 0 ? -deltax : deltax);
+	if (parm_cost(PARM_COL, dstx) < best) best = parm_cost(PARM_COL, dstx), parm = PARM_COL;
+	if (deltax > 0 && (c = rewrite_cost(dsty, srcx, deltax, best)) >= 0) best = c, parm = -1;
+
 	if (deltax < 0) {
 		p = Wcm.cm_left, c = Wcm.cc_left, deltax = -deltax;
 		goto dodelta;		/* skip all the tab junk */
@@ -177,12 +234,13 @@ x:
 	if (tabcost >= BIG)		/* caint use tabs */
 		goto newdelta;
 
-	 /* See if tabcost is less than just moving right */
+	 /* See if tabcost is less than just moving right (or the alternatives) */
 
-	if (tabcost < (deltax * Wcm.cc_right)) {
+	if (tabcost < (deltax * Wcm.cc_right) && tabcost < best) {
 		totalcost += tabcost;	/* use the tabs */
 		if (doit) while (ntabs-- != 0) tputs (Wcm.cm_tab, 1, cmputc);
 		srcx = tabx;
+		best = BIG;
 	}
 
 	 /* Now might as well just recompute the delta. */
@@ -194,6 +252,14 @@ x:
 	else p = Wcm.cm_left, c = Wcm.cc_left, deltax = -deltax;
 	
  dodelta: 
+	if (best < BIG && (c >= BIG || best <= c * deltax)) {
+		totalcost += best;
+		if (doit) {
+			if (parm == -1) rewrite(dsty, srcx, dstx - srcx);
+			else tputs (parm_string(parm, parm == PARM_COL ? dstx : deltax), 1, cmputc);
+		}
+		goto done;
+	}
 	if (c == BIG) {		/* caint get thar from here */
 	fail:
 		if (doit)
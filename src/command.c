@@ -102,8 +102,11 @@ static const command commands[ACTION_COUNT] = {
 	{ NAHL(GOTOCOLUMN    ),0                                                                      },
 	{ NAHL(GOTOLINE      ),0                                                                      },
 	{ NAHL(GOTOMARK      ), NO_ARGS                                                               },
+	{ NAHL(GREP          ),           ARG_IS_STRING                                               },
+	{ NAHL(GREPREGEXP    ),           ARG_IS_STRING                                               },
 	{ NAHL(HELP          ),           ARG_IS_STRING |             DO_NOT_RECORD                   },
 	{ NAHL(HEXCODE       ),                           IS_OPTION                                   },
+	{ NAHL(HIGHLIGHTMATCHES),                         IS_OPTION                                   },
 	{ NAHL(INSERT        ),                           IS_OPTION                                   },
 	{ NAHL(INSERTCHAR    ),0                                                                      },
 	{ NAHL(INSERTLINE    ),0                                                                      },
@@ -140,6 +143,7 @@ static const command commands[ACTION_COUNT] = {
 	{ NAHL(OPEN          ),           ARG_IS_STRING                                               },
 	{ NAHL(OPENCLIP      ),           ARG_IS_STRING                                               },
 	{ NAHL(OPENMACRO     ),           ARG_IS_STRING                                               },
+	{ NAHL(OPENMATCH     ), NO_ARGS                                                               },
 	{ NAHL(OPENNEW       ),           ARG_IS_STRING                                               },
 	{ NAHL(PAGEDOWN      ),0                                                                      },
 	{ NAHL(PAGEUP        ),0                                                                      },
@@ -161,6 +165,7 @@ static const command commands[ACTION_COUNT] = {
 	{ NAHL(REPEATLAST    ),0                                                                      },
 	{ NAHL(REPLACE       ),           ARG_IS_STRING |                             EMPTY_STRING_OK },
 	{ NAHL(REPLACEALL    ),           ARG_IS_STRING |                             EMPTY_STRING_OK },
+	{ NAHL(REPLACEALLDOCS),           ARG_IS_STRING |                             EMPTY_STRING_OK },
 	{ NAHL(REPLACEONCE   ),           ARG_IS_STRING |                             EMPTY_STRING_OK },
 	{ NAHL(REQUESTORDER  ),                           IS_OPTION                                   },
 	{ NAHL(RIGHTMARGIN   ),                           IS_OPTION                                   },
@@ -179,6 +184,7 @@ static const command commands[ACTION_COUNT] = {
 	{ NAHL(SHIFTTABS     ),                           IS_OPTION                                   },
 	{ NAHL(STATUSBAR     ),                           IS_OPTION                                   },
 	{ NAHL(SUSPEND       ), NO_ARGS                                                               },
+	{ NAHL(SYNCLINES     ),                           IS_OPTION                                   },
 	{ NAHL(SYNTAX        ),           ARG_IS_STRING | IS_OPTION                                   },
 	{ NAHL(SYSTEM        ),           ARG_IS_STRING                                               },
 	{ NAHL(TABS          ),                           IS_OPTION                                   },
@@ -519,6 +525,7 @@ int play_macro(buffer *b, char_stream *cs) {
 
 	stop = false;
 
+	const bool executing_macro = b->executing_macro;
 	b->executing_macro = 1;
 	int error = OK;
 	while(!stop && p - stream < len) {	
@@ -540,6 +547,7 @@ int play_macro(buffer *b, char_stream *cs) {
 	}
 
 	free(stream);
+	b->executing_macro = executing_macro;
 
 	return stop ? STOPPED : error;
 }
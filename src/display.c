@@ -21,6 +21,7 @@
 
 #include "ne.h"
 #include "support.h"
+#include "regex.h"
 #include "cm.h"
 #include "termchar.h"
 
@@ -28,15 +29,30 @@
 /* The functions in this file act as an interface between the main code and the
    raw screen updating functions of term.c. The basic idea is that one has a
    series of functions which normally just call the basic functions; however,
-   if more than turbo (or lines*2, if turbo is zero) lines have been updated,
-   the update stops and is delayed to the next call to refresh_window(). This
-   function should be called whenever the screen has to be sync'd with its
-   contents (for instance, whenever the user gets back in control). The
-   mechanism allows for fast, responsive screen updates for short operations,
-   and one-in-all updates for long operations. */
+   if more than turbo (or an adaptive threshold, if turbo is zero; see
+   adapt_turbo()) lines have been updated, the update stops and is delayed to
+   the next call to refresh_window(). This function should be called whenever
+   the screen has to be sync'd with its contents (for instance, whenever the
+   user gets back in control). The mechanism allows for fast, responsive
+   screen updates for short operations, and one-in-all updates for long
+   operations. */
 
 
-#define TURBO (turbo ? turbo : ne_lines * 2)
+#define TURBO (turbo ? turbo : adaptive_turbo ? adaptive_turbo : ne_lines * 2)
+
+/* The threshold used when turbo is zero, or zero if we do not know enough
+   about the terminal yet. */
+
+static int adaptive_turbo;
+
+/* Exponentially weighted averages of the number of bytes emitted per line by
+   update_line() and by update_window_lines(). */
+
+static double line_bytes, repaint_line_bytes;
+
+static void average_bytes(double * const avg, const double bytes) {
+	*avg = *avg ? *avg * .9 + bytes * .1 : bytes;
+}
 
 
 /* If true, the current line has changed and care must be taken to update the initial state of the following lines. */
@@ -65,6 +81,31 @@ void delay_update() {
 }
 
 
+/* Set by postpone_update(), and cleared by refresh_window(). */
+
+static bool update_postponed;
+
+/* Used by the main loop instead of delay_update() when it skips a refresh
+   because more keys are pending. If one of those keys opens a prompt, the
+   window is brought up to date by refresh_postponed() before waiting for
+   input. */
+
+void postpone_update(void) {
+	delay_update();
+	update_postponed = true;
+}
+
+
+/* Does the refresh the main loop has postponed, if any. */
+
+void refresh_postponed(buffer * const b) {
+	if (!update_postponed) return;
+	refresh_window(b);
+	draw_status_bar();
+	move_cursor(b->cur_y, b->cur_x);
+}
+
+
 /* Compares two highlight states for equality. */
 
 int highlight_cmp(HIGHLIGHT_STATE *x, HIGHLIGHT_STATE *y) {
@@ -72,6 +113,298 @@ int highlight_cmp(HIGHLIGHT_STATE *x, HIGHLIGHT_STATE *y) {
 }
 
 
+/* Returns the compiled sync pattern of the given syntax, or NULL. The last
+   compiled pattern is cached, keyed on both the syntax and a copy of the
+   pattern, as a syntax might be freed and reloaded at the same address. */
+
+static struct re_pattern_buffer *sync_pattern(const struct high_syntax * const syn) {
+	static const struct high_syntax *compiled_syn;
+	static char *compiled_pattern;
+	static struct re_pattern_buffer re_pb;
+	static char fastmap[256];
+	static bool compiled;
+
+	const char * const pattern = (const char *)syn->sync_pattern;
+	if (!pattern) return NULL;
+	if (syn != compiled_syn || strcmp(pattern, compiled_pattern)) {
+		char * const p = str_dup(pattern);
+		if (!p) return NULL;
+		free(compiled_pattern);
+		compiled_pattern = p;
+		compiled_syn = syn;
+
+		/* regfree() would free our static fastmap. */
+		re_pb.fastmap = NULL;
+		regfree(&re_pb);
+		re_pb.fastmap = fastmap;
+		re_pb.translate = NULL;
+		compiled = re_compile_pattern(pattern, strlen(pattern), &re_pb) == NULL;
+	}
+	return compiled ? &re_pb : NULL;
+}
+
+
+/* Computes the initial syntax states of the lines of b before line n,
+   starting from the watermark b->syn_valid, which is moved forward. Visible
+   lines whose state changes are marked for refresh. This function uses the
+   local attribute buffer.
+
+   If b->windowed_syntax is true, states are valid only starting from
+   b->syn_window_start. If we need states before it, or far beyond the
+   watermark, we restart parsing from the idle state on the nearest line
+   matching the sync pattern of the syntax, looking back at most the given
+   number of sync lines from the first visible line (if no line matches, we
+   start from the farthest one). Highlighting is thus approximate, but its
+   cost does not depend on the position in the file.
+
+   Otherwise, if the watermark has been moved back by update_syntax_states(),
+   the states up to the previous watermark b->syn_resume are still those
+   computed before the edit: as soon as a recomputed state coincides with the
+   stored one, we move the watermark straight to b->syn_resume, possibly
+   beyond line n. */
+
+void ensure_syntax_states(buffer * const b, int64_t n) {
+	if (!b->syn) return;
+	if (!b->syn_valid_ld) reset_syntax_states(b);
+	if (n > b->num_lines) n = b->num_lines;
+
+	line_desc *ld = b->syn_valid_ld;
+	int64_t line = b->syn_valid;
+	HIGHLIGHT_STATE next_line_state;
+	bool restart = false;
+
+	if (b->windowed_syntax) {
+		/* If line n - 1 is not visible, we just need its surroundings. */
+		const int64_t first = n - 1 >= b->win_y && n - 1 < b->win_y + ne_lines ? b->win_y : n - 1;
+		const int64_t window = b->syn->sync_lines > 0 ? b->syn->sync_lines : sync_lines;
+		if (first >= b->syn_window_start && n <= b->syn_valid) return;
+
+		restart = first < b->syn_window_start || first > b->syn_valid + window;
+		if (restart) {
+			struct re_pattern_buffer * const re_pb = sync_pattern(b->syn);
+			line = first;
+			ld = b->top_line_desc;
+			for(int64_t i = b->win_y; i > first; i--) ld = (line_desc *)ld->ld_node.prev;
+			for(int64_t i = b->win_y; i < first; i++) ld = (line_desc *)ld->ld_node.next;
+
+			for(int64_t i = 0; i < window && line > 0; i++) {
+				if (re_pb && re_search(re_pb, ld->line ? ld->line : "", ld->line_len, 0, ld->line_len, NULL) >= 0) break;
+				ld = (line_desc *)ld->ld_node.prev;
+				line--;
+			}
+
+			const HIGHLIGHT_STATE initial_state = { 0, 0, "" };
+			next_line_state = initial_state;
+			b->syn_window_start = line;
+		}
+	}
+	else if (b->syn_valid >= n) return;
+
+	if (!restart) {
+		line_desc * const prev = (line_desc *)ld->ld_node.prev;
+		next_line_state = parse(b->syn, prev, prev->highlight_state, b->encoding == ENC_UTF8);
+	}
+
+	while(line < n) {
+		if (!highlight_cmp(&ld->highlight_state, &next_line_state)) {
+			const int64_t row = line - b->win_y;
+			if (row >= 0 && row < ne_lines - 1) {
+				window_needs_refresh = true;
+				if (row < first_line) first_line = row;
+				if (row > last_line) last_line = row;
+			}
+			if (line == b->cur_line) b->attr_len = -1;
+			ld->highlight_state = next_line_state;
+		}
+		else if (line < b->syn_resume) {
+			/* The following states have been computed before the watermark was moved back. */
+			line = b->syn_resume;
+			ld = b->syn_resume_ld;
+			b->syn_resume = 0;
+			if (line < n) {
+				line_desc * const prev = (line_desc *)ld->ld_node.prev;
+				next_line_state = parse(b->syn, prev, prev->highlight_state, b->encoding == ENC_UTF8);
+			}
+			continue;
+		}
+		next_line_state = parse(b->syn, ld, ld->highlight_state, b->encoding == ENC_UTF8);
+		ld = (line_desc *)ld->ld_node.next;
+		line++;
+	}
+
+	b->syn_valid = line;
+	b->syn_valid_ld = ld;
+}
+
+
+/* Returns the given attribute modified as specified by mode, which is
+   interpreted as the argument of AutoMatchBracket. */
+
+static uint32_t emphasize_attr(const uint32_t attr, const int mode) {
+	uint32_t new_attr = attr;
+
+	if (mode & 1) { /* invert boldness of FG, BG */
+		switch (attr & BG_MASK) {
+		case BG_BLACK:    new_attr = (new_attr & ~BG_MASK ) | BG_BBLACK;       break;
+		case BG_RED:      new_attr = (new_attr & ~BG_MASK ) | BG_BRED;         break;
+		case BG_GREEN:    new_attr = (new_attr & ~BG_MASK ) | BG_BGREEN;       break;
+		case BG_YELLOW:   new_attr = (new_attr & ~BG_MASK ) | BG_BYELLOW;      break;
+		case BG_BLUE:     new_attr = (new_attr & ~BG_MASK ) | BG_BBLUE;        break;
+		case BG_MAGENTA:  new_attr = (new_attr & ~BG_MASK ) | BG_BMAGENTA;     break;
+		case BG_CYAN:     new_attr = (new_attr & ~BG_MASK ) | BG_BCYAN;        break;
+		case BG_WHITE:    new_attr = (new_attr & ~BG_MASK ) | BG_BWHITE;       break;
+		case BG_BBLACK:   new_attr = (new_attr & ~BG_MASK ) | BG_BLACK;        break;
+		case BG_BRED:     new_attr = (new_attr & ~BG_MASK ) | BG_RED;          break;
+		case BG_BGREEN:   new_attr = (new_attr & ~BG_MASK ) | BG_GREEN;        break;
+		case BG_BYELLOW:  new_attr = (new_attr & ~BG_MASK ) | BG_YELLOW;       break;
+		case BG_BBLUE:    new_attr = (new_attr & ~BG_MASK ) | BG_BLUE;         break;
+		case BG_BMAGENTA: new_attr = (new_attr & ~BG_MASK ) | BG_MAGENTA;      break;
+		case BG_BCYAN:    new_attr = (new_attr & ~BG_MASK ) | BG_CYAN;         break;
+		case BG_BWHITE:   new_attr = (new_attr & ~BG_MASK ) | BG_WHITE;        break;
+		default:          new_attr = (new_attr & ~BG_MASK ) | BG_BWHITE;       break;
+		}
+
+		switch (attr & FG_MASK) {
+		case FG_BLACK:    new_attr = (new_attr & ~FG_MASK) | FG_BBLACK;      break;
+		case FG_RED:      new_attr = (new_attr & ~FG_MASK) | FG_BRED;        break;
+		case FG_GREEN:    new_attr = (new_attr & ~FG_MASK) | FG_BGREEN;      break;
+		case FG_YELLOW:   new_attr = (new_attr & ~FG_MASK) | FG_BYELLOW;     break;
+		case FG_BLUE:     new_attr = (new_attr & ~FG_MASK) | FG_BBLUE;       break;
+		case FG_MAGENTA:  new_attr = (new_attr & ~FG_MASK) | FG_BMAGENTA;    break;
+		case FG_CYAN:     new_attr = (new_attr & ~FG_MASK) | FG_BCYAN;       break;
+		case FG_WHITE:    new_attr = (new_attr & ~FG_MASK) | FG_BWHITE;      break;
+		case FG_BBLACK:   new_attr = (new_attr & ~FG_MASK) | FG_BLACK;       break;
+		case FG_BRED:     new_attr = (new_attr & ~FG_MASK) | FG_RED;         break;
+		case FG_BGREEN:   new_attr = (new_attr & ~FG_MASK) | FG_GREEN;       break;
+		case FG_BYELLOW:  new_attr = (new_attr & ~FG_MASK) | FG_YELLOW;      break;
+		case FG_BBLUE:    new_attr = (new_attr & ~FG_MASK) | FG_BLUE;        break;
+		case FG_BMAGENTA: new_attr = (new_attr & ~FG_MASK) | FG_MAGENTA;     break;
+		case FG_BCYAN:    new_attr = (new_attr & ~FG_MASK) | FG_CYAN;        break;
+		case FG_BWHITE:   new_attr = (new_attr & ~FG_MASK) | FG_WHITE;       break;
+		default:          new_attr = (new_attr & ~FG_MASK) | FG_BBLACK;      break;
+		}
+	}
+	if (mode & 2) new_attr ^= INVERSE;
+	if (mode & 4) new_attr ^= BOLD;
+	if (mode & 8) new_attr ^= UNDERLINE;
+	return new_attr;
+}
+
+
+/* A cursor scanning attribute runs one character at a time. Past the end
+   of the runs, attributes are zero. */
+
+typedef struct {
+	const attr_spans *a;
+	int64_t i;     /* The current run. */
+	int64_t left;  /* Characters left in the current run. */
+} attr_cursor;
+
+static inline void attr_cursor_init(attr_cursor * const c, const attr_spans * const a) {
+	c->a = a;
+	c->i = 0;
+	c->left = a && a->nspans ? a->span[0].len : 0;
+}
+
+static inline uint32_t attr_cursor_get(const attr_cursor * const c) {
+	return c->a && c->i < c->a->nspans ? c->a->span[c->i].attr : 0;
+}
+
+static inline void attr_cursor_next(attr_cursor * const c) {
+	if (c->a && c->i < c->a->nspans && --c->left == 0 && ++c->i < c->a->nspans) c->left = c->a->span[c->i].len;
+}
+
+/* Returns the number of positions, starting from the current one, sharing its attribute. */
+
+static inline int64_t attr_cursor_left(const attr_cursor * const c) {
+	return c->a && c->i < c->a->nspans ? c->left : INT64_MAX;
+}
+
+static inline void attr_cursor_skip(attr_cursor * const c, int64_t n) {
+	while(c->a && c->i < c->a->nspans && n != 0) {
+		if (n < c->left) {
+			c->left -= n;
+			return;
+		}
+		n -= c->left;
+		if (++c->i < c->a->nspans) c->left = c->a->span[c->i].len;
+	}
+}
+
+
+/* Appends to a the attributes of the next n positions of c, emphasized as
+   specified by mode (see emphasize_attr()) if mode is nonzero. */
+
+static void attr_append_cursor(attr_spans * const a, attr_cursor * const c, int64_t n, const int mode) {
+	while(n > 0) {
+		const int64_t k = min(attr_cursor_left(c), n);
+		const uint32_t attr = attr_cursor_get(c);
+		attr_append(a, k, mode ? emphasize_attr(attr, mode) : attr);
+		attr_cursor_skip(c, k);
+		n -= k;
+	}
+}
+
+
+/* If match highlighting is active (see highlight_serial()), returns the
+   attributes of the characters of ld (i.e., attr, or no attributes if attr is
+   NULL) with the occurrences of the find string emphasized as specified by
+   b->opt.highlight_matches. Otherwise, returns attr. The result is stored in
+   local runs that are overwritten at each call. */
+
+static const attr_spans *highlight_matches(const buffer * const b, const line_desc * const ld, const attr_spans * const attr) {
+	static attr_spans hl_attr_buf;
+	const int64_t *start, *end;
+	int n;
+
+	if (!highlight_serial(b) || (n = find_line_matches(ld, &start, &end)) == 0) return attr;
+
+	/* We rebuild the runs in a single pass, emphasizing the matches one run at a time. */
+	attr_cursor c;
+	attr_cursor_init(&c, attr);
+	hl_attr_buf.nspans = hl_attr_buf.len = 0;
+
+	for(int64_t i = 0, pos = 0, char_pos = 0; i < n; i++) {
+		for(; pos < start[i]; pos = next_pos(ld->line, pos, b->encoding)) char_pos++;
+		attr_append_cursor(&hl_attr_buf, &c, char_pos - hl_attr_buf.len, 0);
+		for(; pos < end[i]; pos = next_pos(ld->line, pos, b->encoding)) char_pos++;
+		attr_append_cursor(&hl_attr_buf, &c, char_pos - hl_attr_buf.len, b->opt.highlight_matches);
+	}
+
+	const int64_t len = attr ? attr->len : calc_char_len(ld, ld->line_len, b->encoding);
+	attr_append_cursor(&hl_attr_buf, &c, len - hl_attr_buf.len, 0);
+	return &hl_attr_buf;
+}
+
+
+/* Expands n attributes starting at pos into a local buffer that is
+   overwritten at each call, as the terminal functions take a vector of
+   attributes, one per character. */
+
+static const uint32_t *attr_vector(const attr_spans * const a, const int64_t pos, const int64_t n) {
+	static uint32_t *v;
+	static int64_t v_size;
+
+	if (n > v_size) {
+		uint32_t * const p = realloc(v, n * sizeof *p);
+		if (!p) return NULL;
+		v = p;
+		v_size = n;
+	}
+
+	attr_cursor c;
+	attr_cursor_init(&c, a);
+	attr_cursor_skip(&c, pos);
+	for(int64_t i = 0; i < n;) {
+		const uint32_t attr = attr_cursor_get(&c);
+		int64_t k = min(attr_cursor_left(&c), n - i);
+		attr_cursor_skip(&c, k);
+		while(k-- != 0) v[i++] = attr;
+	}
+
+	return v;
+}
+
 
 /* Updates the initial syntax state of line descriptors starting from a given line descriptor.
 If row is nonnegative, we assume that we have also to update differentially the given lines.
@@ -85,15 +418,26 @@ initial state concides with the final state of the previous line; in case you wa
 more lines to be updated, you can provide a non-NULL end_ld. Note that, in any case, we
 update only visibile lines (albeit initial states will be updated as necessary).
 
+If we start from the current line, propagation stops at the bottom of the screen: if
+states are still changing, the watermark is moved back, so that the remaining lines
+will be parsed while waiting for input (or when they are displayed).
+
 This function uses the local attribute buffer: thus, after a call the local attribute buffer
 could be invalidated. */
 
 void update_syntax_states(buffer *b, int row, line_desc *ld, line_desc *end_ld) {
 
+	/* Lines outside the valid range will be handled by ensure_syntax_states(). */
+	if (b->syn && need_attr_update && ld == b->cur_line_desc && (b->cur_line >= b->syn_valid || b->cur_line < b->syn_window_start)) need_attr_update = false;
+
 	if (b->syn && need_attr_update) {
  		bool got_end_ld = end_ld == NULL;
 		bool invalidate_attr_buf = false;
 		HIGHLIGHT_STATE next_line_state = b->attr_len < 0 ? parse(b->syn, ld, ld->highlight_state, b->encoding == ENC_UTF8) : b->next_state;
+		/* The line number of ld, if known. */
+		int64_t line = ld == b->cur_line_desc ? b->cur_line : -1;
+		/* When highlighting matches we cannot update differentially. */
+		const bool differential = !highlight_serial(b);
 
 		assert(b->attr_len < 0 || b->attr_len == calc_char_len(ld, ld->line_len, b->encoding));
 
@@ -105,6 +449,19 @@ void update_syntax_states(buffer *b, int row, line_desc *ld, line_desc *end_ld)
 			/* We update lines until next_line_state is equal to our current highlight_state, but we go until
 			   end_ld if it is not NULL. In any case, we bail out at the end of the file. */
 			if ((highlight_cmp(&ld->highlight_state, &next_line_state) && got_end_ld) || !ld->ld_node.next) break;
+			/* States after the watermark will be computed by ensure_syntax_states(). */
+			if (ld == b->syn_valid_ld) break;
+			/* States below the screen, too, once we moved back the watermark. */
+			if (line >= 0 && ++line >= b->win_y + ne_lines - 1 && got_end_ld) {
+				/* We remember the farthest previous watermark (see ensure_syntax_states()). */
+				if (!b->windowed_syntax && b->syn_resume < b->syn_valid) {
+					b->syn_resume = b->syn_valid;
+					b->syn_resume_ld = b->syn_valid_ld;
+				}
+				b->syn_valid = line;
+				b->syn_valid_ld = ld;
+				break;
+			}
 
 			if (row >= 0) {
 				row++;
@@ -133,7 +490,7 @@ void update_syntax_states(buffer *b, int row, line_desc *ld, line_desc *end_ld)
 			   current on-screen attributes, whereas attr_buf contains the new attributes, so we can
 			   perform a differential update. */
 			if (row >= 0 && row < ne_lines - 1 && ! window_needs_refresh)
-				output_line_desc(row, 0, ld, b->win_x, ne_columns, b->opt.tab_size, true, b->encoding == ENC_UTF8, attr_buf, b->attr_buf, b->attr_len);
+				output_line_desc(row, 0, ld, b->win_x, ne_columns, b->opt.tab_size, true, b->encoding == ENC_UTF8, highlight_matches(b, ld, &attr_buf), differential ? &b->attr_buf : NULL, differential ? b->attr_len : 0);
 
 			if (ld == end_ld) got_end_ld = true;
 		}
@@ -155,13 +512,13 @@ void update_syntax_states(buffer *b, int row, line_desc *ld, line_desc *end_ld)
    meaning as in update_line(). If utf8 is true, then the line content is
    considered to be UTF-8 encoded.
 
-   If attr is not NULL, it contains a the list of attributes for the line
+   If attr is not NULL, it contains the attribute runs for the line
    descriptor; if diff is not NULL, the update is differential: we assume
    that the line is already correctly displayed with the attributes
    specified in diff. If diff_size is shorter than the current line, all
    characters without differential information will be updated. */
 
-void output_line_desc(const int row, const int col, const line_desc *ld, const int64_t from_col, const int64_t num_cols, const int tab_size, const bool cleared_at_end, const bool utf8, const uint32_t * const attr, const uint32_t * const diff, const int64_t diff_size) {
+static void inline output_line_desc_enc(const int row, const int col, const line_desc *ld, const int64_t from_col, const int64_t num_cols, const int tab_size, const bool cleared_at_end, const bool utf8, const attr_spans * const attr, const attr_spans * const diff, const int64_t diff_size) {
 	assert(ld != NULL);
 	assert(row < ne_lines - 1 && col < ne_columns);
 
@@ -173,36 +530,71 @@ void output_line_desc(const int row, const int col, const line_desc *ld, const i
 
 	const char *s = ld->line;
 	int64_t curr_col = 0, pos = 0, attr_pos = 0;
+	attr_cursor attr_cur, diff_cur;
+	attr_cursor_init(&attr_cur, attr);
+	attr_cursor_init(&diff_cur, diff);
+
+	/* On long lines we skip directly to the last checkpoint before from_col,
+		as the characters preceding it are not visible. */
+	if (from_col > 0 && ld->line_len >= LINE_INDEX_THRESHOLD) {
+		const line_checkpoint cp = line_checkpoint_at_col(ld, from_col, tab_size, utf8 ? ENC_UTF8 : ENC_8_BIT);
+		s += cp.pos;
+		pos = cp.pos;
+		curr_col = cp.width;
+		attr_pos = cp.chars;
+		attr_cursor_skip(&attr_cur, cp.chars);
+		attr_cursor_skip(&diff_cur, cp.chars);
+	}
 
 	while(curr_col - from_col < num_cols && pos < ld->line_len) {
 		const int64_t output_col = col + curr_col - from_col;
-		const int c = utf8 ? get_char(s, ENC_UTF8) : *s;
+		const int c = get_char(s, utf8 ? ENC_UTF8 : ENC_8_BIT);
 		const int c_len = utf8 ? utf8seqlen(c) : 1;
+		const uint32_t a = attr ? attr_cursor_get(&attr_cur) : 0;
 
 		assert(c_len >= 1);
 
 		if (*s == '\t') {
 			const int tab_width = tab_size - curr_col % tab_size;
 
-			for(int i = 0; i < tab_width; i++)
-				if (curr_col + i >= from_col && curr_col + i < from_col + num_cols) {
-					move_cursor(row, output_col + i);
-					output_char(' ', attr ? attr[attr_pos] : 0, false);
-				}
+			/* We output the visible part of the TAB expansion. */
+			const int64_t first = max(0, from_col - curr_col), last = min(tab_width, from_col + num_cols - curr_col);
+			if (first < last) {
+				move_cursor(row, output_col + first);
+				output_spaces(last - first, &a);
+			}
 
 			curr_col += tab_width;
 		}
 		else {
-			const int c_width = output_width(c);
+			const int c_width = get_char_width(s, utf8 ? ENC_UTF8 : ENC_8_BIT);
+
+			if (!diff && output_col >= col && output_col + c_width <= ne_columns) {
+				/* We output at once the following characters up to the next TAB
+					that share the same attribute. */
+				const char * const t = memchr(s, '\t', ld->line_len - pos);
+				const int64_t len = t ? t - s : ld->line_len - pos;
+				int n = min(attr ? attr_cursor_left(&attr_cur) : len, INT_MAX), width = min(col + num_cols, ne_columns) - output_col;
+				move_cursor(row, output_col);
+				const int run_len = output_run(s, a, min(len, INT_MAX), &n, &width, utf8);
+				if (run_len != 0) {
+					s += run_len;
+					pos += run_len;
+					attr_pos += n;
+					curr_col += width;
+					attr_cursor_skip(&attr_cur, n);
+					continue;
+				}
+			}
 
 			if (output_col >= col) {
 				if (output_col + c_width <= ne_columns) {
 					if (attr) {
 						/* In the case of a differential update, we output only
 							characters whose attributes have changed. */
-						if (!diff || diff && (attr_pos >= diff_size || diff[attr_pos] != attr[attr_pos])) {
+						if (!diff || diff && (attr_pos >= diff_size || attr_cursor_get(&diff_cur) != a)) {
 							move_cursor(row, output_col);
-							output_char(c, attr[attr_pos], utf8);
+							output_char(c, a, utf8);
 						}
 					}
 					else {
@@ -214,7 +606,7 @@ void output_line_desc(const int row, const int col, const line_desc *ld, const i
 					/* The current character is too wide: we can only output spaces
 						in place of its visible part. */
 					move_cursor(row, output_col);
-					output_spaces(ne_columns - output_col, attr ? &attr[attr_pos] : NULL);
+					output_spaces(ne_columns - output_col, attr ? &a : NULL);
 				}
 			}
 			else if (output_col + c_width > col) {
@@ -222,7 +614,7 @@ void output_line_desc(const int row, const int col, const line_desc *ld, const i
 				const int output_width = output_col + c_width - col;
 				for(int i = 0; i < output_width; i++) {
 					move_cursor(row, col + i);
-					output_char(' ', attr ? attr[attr_pos] : 0, false);
+					output_char(' ', a, false);
 				}
 			}
 
@@ -231,6 +623,8 @@ void output_line_desc(const int row, const int col, const line_desc *ld, const i
 		s += c_len;
 		pos += c_len;
 		attr_pos++;
+		attr_cursor_next(&attr_cur);
+		attr_cursor_next(&diff_cur);
 	}
 
 	/* If we have exhausted the characters in the line, we haven't still
@@ -243,6 +637,14 @@ void output_line_desc(const int row, const int col, const line_desc *ld, const i
 	}
 }
 
+/* The scan of output_line_desc_enc() is specialized for UTF-8 and for
+   single-byte text, in which case it needs no decoding. */
+
+void output_line_desc(const int row, const int col, const line_desc *ld, const int64_t from_col, const int64_t num_cols, const int tab_size, const bool cleared_at_end, const bool utf8, const attr_spans * const attr, const attr_spans * const diff, const int64_t diff_size) {
+	if (utf8) output_line_desc_enc(row, col, ld, from_col, num_cols, tab_size, cleared_at_end, true, attr, diff, diff_size);
+	else output_line_desc_enc(row, col, ld, from_col, num_cols, tab_size, cleared_at_end, false, attr, diff, diff_size);
+}
+
 /* Updates part of a line given its number, its line descriptor and a starting
 	column. It can handle lines after the end of the buffer (just pass the
    tail of the line list). It checks for updated_lines bypassing TURBO, in
@@ -268,6 +670,7 @@ void update_line(buffer * const b, line_desc * const ld, const int row, const in
 	assert(ld);
 	assert(row < ne_lines - 1);
 
+	ensure_syntax_states(b, b->win_y + ne_lines - 1);
 	if (++updated_lines > TURBO) window_needs_refresh = true;
 
 	if (window_needs_refresh) {
@@ -287,19 +690,24 @@ void update_line(buffer * const b, line_desc * const ld, const int row, const in
 		return;
 	}
 
+	const uint64_t start_count = output_count();
+
 	if (b->syn) {
-		const bool differential = ld == b->cur_line_desc && b->attr_len >= 0;
+		const bool differential = ld == b->cur_line_desc && b->attr_len >= 0 && !highlight_serial(b);
 		HIGHLIGHT_STATE next_state = parse(b->syn, ld, ld->highlight_state, b->encoding == ENC_UTF8);
-		output_line_desc(row, 0, ld, b->win_x, ne_columns, b->opt.tab_size, cleared_at_end, b->encoding == ENC_UTF8, attr_buf, differential ? b->attr_buf : NULL, differential ? b->attr_len : 0);
+		output_line_desc(row, 0, ld, b->win_x, ne_columns, b->opt.tab_size, cleared_at_end, b->encoding == ENC_UTF8, highlight_matches(b, ld, &attr_buf), differential ? &b->attr_buf : NULL, differential ? b->attr_len : 0);
 
 		if (ld == b->cur_line_desc) {
 			/* If we updated current line, we update the local attribute buffer. */
 			b->next_state = next_state;
-			ensure_attr_buf(b, attr_len);
-			memcpy(b->attr_buf, attr_buf, (b->attr_len = attr_len) * sizeof *b->attr_buf);
+			attr_copy(&b->attr_buf, &attr_buf);
+			b->attr_len = attr_len;
 		}
 	}
+	else if (highlight_serial(b)) output_line_desc(row, 0, ld, b->win_x, ne_columns, b->opt.tab_size, cleared_at_end, b->encoding == ENC_UTF8, highlight_matches(b, ld, NULL), NULL, 0);
 	else output_line_desc(row, from_col, ld, from_col + b->win_x, ne_columns - from_col, b->opt.tab_size, cleared_at_end, b->encoding == ENC_UTF8, NULL, NULL, 0);
+
+	average_bytes(&line_bytes, output_count() - start_count);
 }
 
 
@@ -312,6 +720,7 @@ void update_line(buffer * const b, line_desc * const ld, const int row, const in
    true forces a real update. Generally, doit should be false. */
 
 void update_window_lines(buffer * const b, line_desc * ld, const int start_line, const int end_line, const bool doit) {
+	ensure_syntax_states(b, b->win_y + ne_lines - 1);
 	if ((updated_lines += (end_line - start_line + 1)) > TURBO && !doit) window_needs_refresh = true;
 
 	if (start_line < first_line) first_line = start_line;
@@ -323,11 +732,13 @@ void update_window_lines(buffer * const b, line_desc * ld, const int start_line,
 	if (first_line != start_line) for(uint64_t i = first_line - start_line; i-- != 0; ) ld = (line_desc *)ld->ld_node.next;
 	assert_line_desc(ld, b->encoding);
 
+	const uint64_t start_count = output_count();
+	begin_repaint();
 	int i;
 	for(i = first_line; i <= last_line && i + b->win_y < b->num_lines; i++) {
 		assert(ld->ld_node.next != NULL);
 		if (b->syn) parse(b->syn, ld, ld->highlight_state, b->encoding == ENC_UTF8);
-		output_line_desc(i, 0, ld, b->win_x, ne_columns, b->opt.tab_size, false, b->encoding == ENC_UTF8, b->syn ? attr_buf : NULL, NULL, 0);
+		output_line_desc(i, 0, ld, b->win_x, ne_columns, b->opt.tab_size, false, b->encoding == ENC_UTF8, highlight_matches(b, ld, b->syn ? &attr_buf : NULL), NULL, 0);
 		ld = (line_desc *)ld->ld_node.next;
 	}
 
@@ -335,6 +746,8 @@ void update_window_lines(buffer * const b, line_desc * ld, const int start_line,
 		move_cursor(i, 0);
 		clear_to_eol();
 	}
+	end_repaint(first_line, last_line);
+	average_bytes(&repaint_line_bytes, (double)(output_count() - start_count) / (last_line - first_line + 1));
 
 	window_needs_refresh = false;
 	first_line = ne_lines;
@@ -384,7 +797,9 @@ void update_deleted_char(buffer * const b, const int c, const int a, line_desc *
 	if (b->syn) {
 		assert(b->attr_len >= 0);
 		assert(b->attr_len > attr_pos);
-		memmove(b->attr_buf + attr_pos, b->attr_buf + attr_pos + 1, (--b->attr_len - attr_pos) * sizeof *b->attr_buf);
+		attr_truncate(&b->attr_buf, b->attr_len);
+		attr_delete(&b->attr_buf, attr_pos, 1);
+		b->attr_len--;
 	}
 
 	if (++updated_lines > TURBO) window_needs_refresh = true;
@@ -395,6 +810,12 @@ void update_deleted_char(buffer * const b, const int c, const int a, line_desc *
 		return;
 	}
 
+	/* Occurrences of the find string might have appeared or disappeared. */
+	if (highlight_serial(b)) {
+		update_line(b, ld, line, 0, false);
+		return;
+	}
+
 	if (pos > ld->line_len || (pos == ld->line_len && ((c == '\t' || c == ' ') && !a))) return;
 
 	move_cursor(line, x);
@@ -435,8 +856,8 @@ void update_deleted_char(buffer * const b, const int c, const int a, line_desc *
 				/* In this case, instead, we just shift the piece of text between
 					our current position and the TAB. Note that this is slower than
 					inserting and deleting, but MUCH nicer to see. */
-				output_chars(&ld->line[pos], b->syn ? &b->attr_buf[attr_pos] : NULL, j - pos, b->encoding == ENC_UTF8);
-				output_spaces(c_width, b->syn ? &b->attr_buf[curr_attr_pos] : NULL);
+				output_chars(&ld->line[pos], b->syn ? attr_vector(&b->attr_buf, attr_pos, j - pos) : NULL, j - pos, b->encoding == ENC_UTF8);
+				output_spaces(c_width, b->syn ? attr_vector(&b->attr_buf, curr_attr_pos, 1) : NULL);
 			}
 			tab_found = true;
 			break;
@@ -457,16 +878,17 @@ void update_deleted_char(buffer * const b, const int c, const int a, line_desc *
 void update_inserted_char(buffer * const b, const int c, line_desc * const ld, const int64_t pos, const int64_t attr_pos, const int line, const int x) {
 	assert(pos < ld->line_len);
 
-	const uint32_t * const attr = b->syn ? &attr_buf[attr_pos] : NULL;
+	const uint32_t a = b->syn ? attr_at(&attr_buf, attr_pos, NULL) : 0;
+	const uint32_t * const attr = b->syn ? &a : NULL;
 
 	if (b->syn) {
 		assert(b->attr_len >= 0);
 		/*fprintf(stderr, "+b->attr_len: %d calc_char_len: %d pos: %d ld->line_len %d attr_pos: %d\n", b->attr_len, calc_char_len(ld, ld->line_len, b->encoding), pos, ld->line_len, attr_pos);*/
 		assert(b->attr_len + 1 == calc_char_len(ld, ld->line_len, b->encoding));
-		/* We update the stored attribute vector. */
-		ensure_attr_buf(b, b->attr_len + 1);
-		memmove(b->attr_buf + attr_pos + 1, b->attr_buf + attr_pos, (b->attr_len++ - attr_pos) * sizeof *b->attr_buf );
-		b->attr_buf[attr_pos] = *attr;
+		/* We update the stored attribute runs. */
+		attr_truncate(&b->attr_buf, b->attr_len);
+		attr_insert(&b->attr_buf, attr_pos, 1, a);
+		b->attr_len++;
 	}
 
 	if (++updated_lines > TURBO) window_needs_refresh = true;
@@ -477,6 +899,12 @@ void update_inserted_char(buffer * const b, const int c, line_desc * const ld, c
 		return;
 	}
 
+	/* Occurrences of the find string might have appeared or disappeared. */
+	if (highlight_serial(b)) {
+		update_line(b, ld, line, 0, false);
+		return;
+	}
+
 	move_cursor(line, x);
 
 	const int c_len = b->encoding == ENC_UTF8 ? utf8seqlen(c) : 1;
@@ -505,7 +933,7 @@ void update_inserted_char(buffer * const b, const int c, line_desc * const ld, c
 			if (tab_width > c_width) {
 				if (c == '\t') output_spaces(c_width, attr);
 				else output_char(c, attr ? *attr : -1, b->encoding == ENC_UTF8);
-				output_chars(&ld->line[pos + c_len], attr, j - (pos + c_len), b->encoding == ENC_UTF8);
+				output_chars(&ld->line[pos + c_len], attr ? attr_vector(&attr_buf, attr_pos, j - (pos + c_len)) : NULL, j - (pos + c_len), b->encoding == ENC_UTF8);
 			}
 			else {
 				if (c == '\t') insert_chars(NULL, attr, c_width, false);
@@ -529,14 +957,16 @@ void update_overwritten_char(buffer * const b, const int old_char, const int new
 	assert(ld != NULL);
 	assert(pos < ld->line_len);
 
-	const uint32_t * const attr = b->syn ? &attr_buf[attr_pos] : NULL;
+	const uint32_t a = b->syn ? attr_at(&attr_buf, attr_pos, NULL) : 0;
+	const uint32_t * const attr = b->syn ? &a : NULL;
 
 	if (b->syn) {
 		/* fprintf(stderr, "-b->attr_len: %d calc_char_len: %d pos: %d ld->line_len %d attr_pos: %d\n", b->attr_len, calc_char_len(ld, ld->line_len, b->encoding), pos, ld->line_len, attr_pos);*/
 		assert(b->attr_len + 1 == calc_char_len(ld, ld->line_len, b->encoding) || b->attr_len == calc_char_len(ld, ld->line_len, b->encoding));
 		assert(attr_pos <= b->attr_len);
-		if (attr_pos == b->attr_len) ensure_attr_buf(b, ++b->attr_len);
-		b->attr_buf[attr_pos] = *attr;
+		attr_truncate(&b->attr_buf, b->attr_len);
+		attr_fill(&b->attr_buf, attr_pos, 1, a);
+		if (attr_pos == b->attr_len) b->attr_len++;
 	}
 
 	if (++updated_lines > TURBO) window_needs_refresh = true;
@@ -547,6 +977,12 @@ void update_overwritten_char(buffer * const b, const int old_char, const int new
 		return;
 	}
 
+	/* Occurrences of the find string might have appeared or disappeared. */
+	if (highlight_serial(b)) {
+		update_line(b, ld, line, 0, false);
+		return;
+	}
+
 	const int old_width = old_char == '\t' ? b->opt.tab_size - x % b->opt.tab_size : output_width(old_char);
 	const int new_width = new_char == '\t' ? b->opt.tab_size - x % b->opt.tab_size : output_width(new_char);
 
@@ -590,8 +1026,8 @@ void update_overwritten_char(buffer * const b, const int old_char, const int new
 				if (width_delta + tab_width <= b->opt.tab_size) {
 					if (new_char == '\t') output_spaces(new_width, attr);
 					else output_char(new_char, attr ? *attr : -1, b->encoding == ENC_UTF8);
-					output_chars(&ld->line[pos], attr, j - pos, b->encoding == ENC_UTF8);
-					output_spaces(width_delta, b->syn ? &b->attr_buf[curr_attr_pos] : NULL);
+					output_chars(&ld->line[pos], attr ? attr_vector(&attr_buf, attr_pos, j - pos) : NULL, j - pos, b->encoding == ENC_UTF8);
+					output_spaces(width_delta, b->syn ? attr_vector(&b->attr_buf, curr_attr_pos, 1) : NULL);
 				}
 				else {
 					if (new_char == '\t') output_spaces(new_width, attr);
@@ -636,7 +1072,7 @@ void update_overwritten_char(buffer * const b, const int old_char, const int new
 				if (width_delta < tab_width) {
 					if (new_char == '\t') output_spaces(new_width, attr);
 					else output_char(new_char, attr ? *attr : -1, b->encoding == ENC_UTF8);
-					output_chars(&ld->line[pos], attr, j - pos, b->encoding == ENC_UTF8);
+					output_chars(&ld->line[pos], attr ? attr_vector(&attr_buf, attr_pos, j - pos) : NULL, j - pos, b->encoding == ENC_UTF8);
 				}
 				else {
 					insert_chars(NULL, attr, width_delta, false);
@@ -672,16 +1108,61 @@ void reset_window(void) {
 
 
 
+/* Recomputes adaptive_turbo. The threshold is the break-even point at which
+   the bytes emitted by single-line updates exceed those of a repaint of the
+   whole window, but the updates must also fit in TURBO_BUDGET seconds on the
+   terminal link, as estimated by link_estimate(). The result never exceeds
+   the traditional default, ne_lines * 2. */
+
+#define TURBO_BUDGET .1
+
+static void adapt_turbo(void) {
+	double bandwidth, latency;
+	if (!line_bytes || !repaint_line_bytes || !link_estimate(&bandwidth, &latency)) return;
+
+	double threshold = (ne_lines - 1) * repaint_line_bytes / line_bytes;
+	const double affordable = (TURBO_BUDGET - latency) * bandwidth / line_bytes;
+	if (affordable < threshold) threshold = affordable;
+	adaptive_turbo = threshold < 8 ? 8 : threshold > ne_lines * 2 ? ne_lines * 2 : threshold;
+}
+
+
 /* Forces the screen update. It should be called whenever the user has to
    interact, so that he is presented with a correctly updated display. */
 
 void refresh_window(buffer * const b) {
+	/* If the pattern to highlight has changed, everything must be redrawn. */
+	static unsigned int shown_highlight_serial;
+	const unsigned int serial = highlight_serial(b);
+
+	update_postponed = false;
+	if (serial != shown_highlight_serial) {
+		shown_highlight_serial = serial;
+		window_needs_refresh = true;
+		first_line = 0;
+		last_line = ne_lines - 2;
+	}
+
+	ensure_syntax_states(b, b->win_y + ne_lines - 1);
+
 	if (window_needs_refresh) {
 		line_desc *ld = b->top_line_desc;
 		for(int i = first_line; i-- != 0 && (line_desc *)ld->ld_node.next;) ld = (line_desc *)ld->ld_node.next;
 		if (ld->ld_node.next) update_window_lines(b, ld, first_line, last_line, true);
+		else {
+			/* The region to refresh is empty, or it lies after the end of the buffer. */
+			for(int i = first_line; i <= last_line; i++) {
+				move_cursor(i, 0);
+				clear_to_eol();
+			}
+			window_needs_refresh = false;
+			first_line = ne_lines;
+			last_line = -1;
+		}
 		updated_lines = 0;
 	}
+
+	adapt_turbo();
 }
 
 
@@ -738,8 +1219,8 @@ void ensure_attributes(buffer *b) {
 void store_attributes(buffer *b, line_desc *ld) {
 	b->next_state = parse(b->syn, ld, ld->highlight_state, b->encoding == ENC_UTF8);
 	assert(calc_char_len(ld, ld->line_len, b->encoding) == attr_len);
-	ensure_attr_buf(b, attr_len);
-	memcpy(b->attr_buf, attr_buf, (b->attr_len = attr_len) * sizeof *b->attr_buf);
+	attr_copy(&b->attr_buf, &attr_buf);
+	b->attr_len = attr_len;
 }
 
 /* (Un)highlights (depending on the value of show) the bracket matching
@@ -751,7 +1232,6 @@ void automatch_bracket(buffer * const b, const bool show) {
 
 	if (show) {
 		int64_t match_pos, match_line;
-		uint32_t tmp_attr;
 		line_desc *matching_ld;
 		if (find_matching_bracket(b, b->win_y, b->win_y + ne_lines - 2 >= b->num_lines - 1 ? b->num_lines - 1 : b->win_y + ne_lines - 2,
 								  &match_line, &match_pos, &c, &matching_ld) == OK) {
@@ -761,63 +1241,11 @@ void automatch_bracket(buffer * const b, const bool show) {
 			b->automatch.x = calc_width(matching_ld, match_pos, b->opt.tab_size, b->encoding) - b->win_x;
 			if (b->automatch.x >= 0 && b->automatch.x < ne_columns ) {
 				move_cursor(b->automatch.y, b->automatch.x);
-				if (b->syn) {
-					parse(b->syn, matching_ld, matching_ld->highlight_state, b->encoding == ENC_UTF8);
-					orig_attr = attr_buf[match_pos];
-				}
+				if (b->syn) parse(b->syn, matching_ld, matching_ld->highlight_state, b->encoding == ENC_UTF8);
+				const attr_spans * const attr = highlight_matches(b, matching_ld, b->syn ? &attr_buf : NULL);
+				if (attr) orig_attr = attr_at(attr, calc_char_len(matching_ld, match_pos, b->encoding), NULL);
 				else orig_attr = 0; /* That's a stretch. FIX_ME */
-				tmp_attr = orig_attr;
-				if (b->opt.automatch & 1 ) { /* invert boldness of FG, BG */
-					switch (orig_attr & BG_MASK) {
-					case BG_BLACK:    tmp_attr = (tmp_attr & ~BG_MASK ) | BG_BBLACK;       break;
-					case BG_RED:      tmp_attr = (tmp_attr & ~BG_MASK ) | BG_BRED;         break;
-					case BG_GREEN:    tmp_attr = (tmp_attr & ~BG_MASK ) | BG_BGREEN;       break;
-					case BG_YELLOW:   tmp_attr = (tmp_attr & ~BG_MASK ) | BG_BYELLOW;      break;
-					case BG_BLUE:     tmp_attr = (tmp_attr & ~BG_MASK ) | BG_BBLUE;        break;
-					case BG_MAGENTA:  tmp_attr = (tmp_attr & ~BG_MASK ) | BG_BMAGENTA;     break;
-					case BG_CYAN:     tmp_attr = (tmp_attr & ~BG_MASK ) | BG_BCYAN;        break;
-					case BG_WHITE:    tmp_attr = (tmp_attr & ~BG_MASK ) | BG_BWHITE;       break;
-					case BG_BBLACK:   tmp_attr = (tmp_attr & ~BG_MASK ) | BG_BLACK;        break;
-					case BG_BRED:     tmp_attr = (tmp_attr & ~BG_MASK ) | BG_RED;          break;
-					case BG_BGREEN:   tmp_attr = (tmp_attr & ~BG_MASK ) | BG_GREEN;        break;
-					case BG_BYELLOW:  tmp_attr = (tmp_attr & ~BG_MASK ) | BG_YELLOW;       break;
-					case BG_BBLUE:    tmp_attr = (tmp_attr & ~BG_MASK ) | BG_BLUE;         break;
-					case BG_BMAGENTA: tmp_attr = (tmp_attr & ~BG_MASK ) | BG_MAGENTA;      break;
-					case BG_BCYAN:    tmp_attr = (tmp_attr & ~BG_MASK ) | BG_CYAN;         break;
-					case BG_BWHITE:   tmp_attr = (tmp_attr & ~BG_MASK ) | BG_WHITE;        break;
-					default:          tmp_attr = (tmp_attr & ~BG_MASK ) | BG_BWHITE;       break;
-					}
-
-					switch (orig_attr & FG_MASK) {
-					case FG_BLACK:    tmp_attr = (tmp_attr & ~FG_MASK) | FG_BBLACK;      break;
-					case FG_RED:      tmp_attr = (tmp_attr & ~FG_MASK) | FG_BRED;        break;
-					case FG_GREEN:    tmp_attr = (tmp_attr & ~FG_MASK) | FG_BGREEN;      break;
-					case FG_YELLOW:   tmp_attr = (tmp_attr & ~FG_MASK) | FG_BYELLOW;     break;
-					case FG_BLUE:     tmp_attr = (tmp_attr & ~FG_MASK) | FG_BBLUE;       break;
-					case FG_MAGENTA:  tmp_attr = (tmp_attr & ~FG_MASK) | FG_BMAGENTA;    break;
-					case FG_CYAN:     tmp_attr = (tmp_attr & ~FG_MASK) | FG_BCYAN;       break;
-					case FG_WHITE:    tmp_attr = (tmp_attr & ~FG_MASK) | FG_BWHITE;      break;
-					case FG_BBLACK:   tmp_attr = (tmp_attr & ~FG_MASK) | FG_BLACK;       break;
-					case FG_BRED:     tmp_attr = (tmp_attr & ~FG_MASK) | FG_RED;         break;
-					case FG_BGREEN:   tmp_attr = (tmp_attr & ~FG_MASK) | FG_GREEN;       break;
-					case FG_BYELLOW:  tmp_attr = (tmp_attr & ~FG_MASK) | FG_YELLOW;      break;
-					case FG_BBLUE:    tmp_attr = (tmp_attr & ~FG_MASK) | FG_BLUE;        break;
-					case FG_BMAGENTA: tmp_attr = (tmp_attr & ~FG_MASK) | FG_MAGENTA;     break;
-					case FG_BCYAN:    tmp_attr = (tmp_attr & ~FG_MASK) | FG_CYAN;        break;
-					case FG_BWHITE:   tmp_attr = (tmp_attr & ~FG_MASK) | FG_WHITE;       break;
-					default:          tmp_attr = (tmp_attr & ~FG_MASK) | FG_BBLACK;      break;
-					}
-				}
-				if (b->opt.automatch & 2 ) {
-					tmp_attr = tmp_attr ^ INVERSE;
-				}
-				if (b->opt.automatch & 4 ) {
-					tmp_attr = tmp_attr ^ BOLD;
-				}
-				if (b->opt.automatch & 8 ) {
-					tmp_attr = tmp_attr ^ UNDERLINE;
-				}
-				output_char(c, tmp_attr, b->encoding == ENC_UTF8);
+				output_char(c, emphasize_attr(orig_attr, b->opt.automatch), b->encoding == ENC_UTF8);
 				b->automatch.shown = 1;
 			}
 		}
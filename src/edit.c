@@ -165,6 +165,8 @@ int find_matching_bracket(buffer *b, const int64_t min_line, int64_t max_line, i
 	while(ld->ld_node.next && ld->ld_node.prev && y >= min_line && y <= max_line) {
 
 		if (pos >= 0) {
+			/* Brackets are US-ASCII characters, and US-ASCII bytes never appear
+				inside UTF-8 sequences: thus, we can scan bytes in all encodings. */
 			char * const line = ld->line;
 			while(pos >= 0 && pos < ld->line_len) {
 
@@ -178,8 +180,7 @@ int find_matching_bracket(buffer *b, const int64_t min_line, int64_t max_line, i
 					if (match_ld) *match_ld = ld;
 					return OK;
 				}
-				if (dir > 0) pos = next_pos(line, pos, b->encoding);
-				else pos = prev_pos(line, pos, b->encoding);
+				pos += dir;
 			}
 		}
 
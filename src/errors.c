@@ -92,7 +92,10 @@ char *error_msg[ERROR_COUNT] = {
 	/* 64 */ "Document not saved.",
 	/* 65*/	"File is too large--syntax highlighting disabled (use SYNTAX to reactivate).",
 	/* 66*/	"Cannot save: disk full.",
-	/* 67*/	"Out of memory (insufficient disk space?). DANGER!"
+	/* 67*/	"Out of memory (insufficient disk space?). DANGER!",
+	/* 68*/	"This line is not a Grep match (file:line:text).",
+	/* 69*/	"File is large--syntax highlighting is approximate (see SYNCLINES).",
+	/* 70*/	"This text cannot be pasted in this buffer (incompatible encoding)."
 };
 
 char *info_msg[INFO_COUNT] = {
@@ -111,6 +111,9 @@ enum error {
 	/* 65 */ FILE_TOO_LARGE_SYNTAX_HIGHLIGHTING_DISABLED,
 	/* 66 */ CANNOT_SAVE_DISK_FULL,
 	/* 67 */ OUT_OF_MEMORY_DISK_FULL,
+	/* 68 */ NOT_A_GREP_MATCH,
+	/* 69 */ FILE_TOO_LARGE_SYNTAX_HIGHLIGHTING_APPROXIMATE,
+	/* 70 */ INCOMPATIBLE_PASTE_ENCODING,
 
 	ERROR_COUNT
 };
@@ -271,6 +271,11 @@ int setupterm(const char * const dummy1, const int dunmmy2, const int * const du
 	ne_cursor_left = tgetstr("le", NULL);
 	ne_cursor_up = tgetstr("up", NULL);
 
+	ne_parm_right_cursor = tgetstr("RI", NULL);
+	ne_parm_down_cursor = tgetstr("DO", NULL);
+	ne_parm_left_cursor = tgetstr("LE", NULL);
+	ne_parm_up_cursor = tgetstr("UP", NULL);
+
 	ne_auto_right_margin = tgetflag("am");
 	ne_eat_newline_glitch = tgetflag("xn");
 
@@ -80,6 +80,9 @@ static unsigned int print_prompt(const char * const prompt) {
 	resume_status_bar = (void (*)(const char *message))&input_and_prompt_refresh;
 	if (prompt) prior_prompt = prompt;
 
+	/* Keys typed ahead might have left the window out of date. */
+	refresh_postponed(cur_buffer);
+
 	move_cursor(ne_lines - 1, 0);
 
 	clear_to_eol();
@@ -302,7 +305,7 @@ static void input_refresh(void) {
 		output_char(get_char(&input_buffer[j], encoding), 0, encoding);
 	}
 	clear_to_eol();
-	fflush(stdout);
+	flush_frame();
 }
 
 void input_and_prompt_refresh() {
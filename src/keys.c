@@ -23,6 +23,7 @@
 #include <time.h>
 #include <signal.h>
 #include <errno.h>
+#include <poll.h>
 #include <string.h>
 
 
@@ -31,7 +32,7 @@
 
 #define MAX_TERM_KEY 512
 
-/* Size of the keyboard input buffer. */
+/* Size of the keyboard input buffer (a power of two). */
 
 #define KBD_BUF_SIZE 512
 
@@ -49,6 +50,10 @@ typedef struct {
 static term_key key[MAX_TERM_KEY];
 static int num_keys;
 
+/* Whether the trie used by get_key_code() reflects the key array. */
+
+static bool trie_valid;
+
 /* Function to pass to qsort for sorting the key capabilities array. */
 
 static int keycmp(const void *t1, const void *t2) {
@@ -129,8 +134,10 @@ int key_may_set(const char * const cap_string, int code) {
 
 	if (num_keys >= MAX_TERM_KEY - 1) return 0;
 	if (!cap_string || (pos = binsearch(cap_string)) < 0) {
-		if (code < 0)
+		if (code < 0) {
 			key[-pos-1].code = -code - 1;
+			trie_valid = false;
+		}
 		return pos;
 	}
    if (code < 0) code = -code - 1;
@@ -138,6 +145,7 @@ int key_may_set(const char * const cap_string, int code) {
 	key[pos].string = cap_string;
 	key[pos].code = code;
 	num_keys++;
+	trie_valid = false;
 	assert(num_keys < MAX_TERM_KEY);
 	return pos+1;
 }
@@ -270,6 +278,13 @@ void read_key_capabilities(void) {
 
 	key_set("\x1B:", NE_KEY_COMMAND);
 
+	/* Bracketed paste. The start sequence is handled by the main loop, which
+		then calls read_paste(); elsewhere (e.g., on the input line) both
+		sequences are ignored, and the pasted text is just typed. */
+
+	key_set(ne_paste_start, NE_KEY_PASTE);
+	key_set(ne_paste_end, NE_KEY_IGNORE);
+
 	assert(num_keys < MAX_TERM_KEY - 1);
 
 	D(fprintf(stderr, "Got %d keys from terminfo\n", num_keys);)
@@ -397,157 +412,244 @@ void set_escape_time(const int new_escape_time) {
 }
 
 
-/* Sets the current timeout in the termios structure relative to stdin. If the
-   timeout value (in tenth of a second) is positive, VMIN is set to 0,
-   otherwise to 1. */
+/* The keyboard ring buffer used by get_key_code(): it contains kbd_len
+   characters, starting at kbd_start. */
+
+static char kbd_buffer[KBD_BUF_SIZE];
+static int kbd_start, kbd_len;
+
+#define KBD(i) (kbd_buffer[(kbd_start + (i)) & (KBD_BUF_SIZE - 1)])
+
+static void kbd_consume(const int n) {
+	kbd_start = (kbd_start + n) & (KBD_BUF_SIZE - 1);
+	kbd_len -= n;
+}
 
-static void set_termios_timeout(const int timeout) {
-	struct termios termios;
 
-	tcgetattr(0, &termios);
+/* Reads into the keyboard buffer as many characters as are available,
+   waiting for at most timeout milliseconds (or forever, if timeout is
+   negative). Returns the number of characters read, 0 if we timed out, or -1
+   in case of error or end of file (errno is EINTR if we have been interrupted
+   by a signal). */
 
-	termios.c_cc[VTIME] = timeout;
-	termios.c_cc[VMIN] = timeout ? 0 : 1;
+static int fill_kbd_buffer(const int timeout) {
+	if (kbd_len == KBD_BUF_SIZE) return 0;
+	if (timeout >= 0) {
+		struct pollfd pfd = { 0, POLLIN, 0 };
+		const int r = poll(&pfd, 1, timeout);
+		if (r <= 0) return r;
+	}
 
-	tcsetattr(0, TCSANOW, &termios);
+	if (kbd_len == 0) kbd_start = 0;
+	const int end = (kbd_start + kbd_len) & (KBD_BUF_SIZE - 1);
+	errno = 0;
+	const ssize_t r = read(0, kbd_buffer + end, end >= kbd_start ? KBD_BUF_SIZE - end : kbd_start - end);
+	if (r <= 0) return -1;
+	kbd_len += r;
+	return r;
 }
 
 
-/* Reads in characters, and tries to match them with the sequences
-   corresponding to special keys. Returns a positive number, denoting
-   a character (possibly INVALID_CHAR), or a negative number denoting a key
-   code (if x is the key code, -x-1 will be returned).
+/* Returns true if some input is available, that is, if get_key_code() will
+   not wait for the user. */
 
-   This function tries to be highly optimized and efficient by employing a
-   sorted array of strings for the terminal keys. An index keeps track of the
-   key which has a partial match with the current contents of the keyboard
-   buffer. As each character is input, a match is tried with the rest of the
-   string. If a new character does not match, we can just increment the key
-   counter (because the array is sorted). When we get out of the array, we give
-   back the first char in the keyboard buffer (the next call will retry a match
-   on the following chars). */
+bool key_pending(void) {
+	if (kbd_len) return true;
+	struct pollfd pfd = { 0, POLLIN, 0 };
+	return poll(&pfd, 1, 0) > 0;
+}
 
 
-int get_key_code(void) {
-	static int cur_len = 0;
-	static char kbd_buffer[KBD_BUF_SIZE];
+/* Reads the text of a bracketed paste, up to and excluding the paste-end
+   sequence. Returns a NUL-terminated buffer allocated with malloc(), and
+   stores in *len its length (the text might contain NULs), or NULL if we
+   ran out of memory (the text is consumed anyway). */
 
-	int c, e, last_match = 0, cur_key = 0;
-	bool partial_match = false, partial_is_utf8 = false;
+char *read_paste(int64_t * const len) {
+	const size_t end_len = strlen(ne_paste_end);
+	size_t size = KBD_BUF_SIZE, n = 0, matched = 0;
+	char *p = malloc(size);
 
-	while(true) {
+	while(matched < end_len) {
+		if (kbd_len == 0) {
+			if (fill_kbd_buffer(-1) < 0 && errno != EINTR) break;
+			continue;
+		}
 
-		if (cur_len) {
+		const int c = (unsigned char)KBD(0);
+		kbd_consume(1);
 
-			/* Something is already in the buffer. last_match is the position
-			we have to check. */
+		if (p && n + 1 == size) {
+			char * const q = realloc(p, size *= 2);
+			if (!q) free(p);
+			p = q;
+		}
+		if (p) p[n++] = c;
 
-			while(last_match < cur_len) {
-				if (last_match == 0 && io_utf8 && (unsigned char)kbd_buffer[0] >= 0x80) {
-					partial_is_utf8 = true;
-					last_match++;
-				}
-				else if (partial_is_utf8) { 	/* Our partial match is an UTF-8 sequence. */
-					if ((kbd_buffer[last_match] & 0xC0) == 0x80) {
-						if (utf8len(kbd_buffer[0]) == ++last_match) {
-							c = utf8char(kbd_buffer);
-							if (cur_len -= last_match) memmove(kbd_buffer, kbd_buffer + last_match, cur_len);
-							return c == -1 ? INVALID_CHAR : c;
-						}
-					}
-					else {
-						/* A UTF-8 error. We discard the first character and try again. */
-						if (--cur_len) memmove(kbd_buffer, kbd_buffer + 1, cur_len);
-						partial_is_utf8 = false;
-						last_match = 0;
-					}
-				}
-				else {
-					/* First easy case. We felt off the array. We return the first character
-						in the buffer and restart the match. */
-
-					if (!key[cur_key].string) {
-						c = kbd_buffer[0];
-						if (--cur_len) memmove(kbd_buffer, kbd_buffer + 1, cur_len);
-						return (unsigned char)c;
-					}
+		if (c == (unsigned char)ne_paste_end[matched]) matched++;
+		else matched = c == (unsigned char)ne_paste_end[0];
+	}
 
-					/* Second case. We have a partial match on the first last_match
-						characters. If another character matches, either the string is terminated,
-						and we return the key code, or we increment the match count. */
+	if (p) {
+		*len = matched == end_len ? n - end_len : n;
+		p[*len] = 0;
+	}
+	return p;
+}
 
 
-					else if (key[cur_key].string[last_match] == kbd_buffer[last_match]) {
-						if (key[cur_key].string[last_match + 1] == 0) {
-							if (cur_len -= last_match + 1) memmove(kbd_buffer, kbd_buffer + last_match + 1, cur_len);
+/* The key capabilities, arranged in a trie for get_key_code(). Node 0 is the
+   root; the children of a node are contiguous and sorted by character. The
+   trie is rebuilt by get_key_code() whenever the key array has changed. */
 
-							assert(key[cur_key].code < NUM_KEYS);
+typedef struct {
+	int first_child;
+	int num_children;
+	int code;			/* The code of the key ending here, or -1. */
+	unsigned char c;
+} trie_node;
 
-							return -key[cur_key].code - 1;
-						}
-						else last_match++;
-					}
+static trie_node *trie;
+static int trie_size;
 
-					/* The tricky part. If there is a failed match, the order guarantees that
-						no match if possible if the code of the keyboard char is greater than the code of
-						the capability char. Otherwise, we check for the first capability starting
-						with the current keyboard characters. */
+/* The key array is sorted in reverse order, so this is the i-th key string
+   in increasing order. */
 
-					else {
-						if (kbd_buffer[last_match] > key[cur_key].string[last_match]) {
-							c = kbd_buffer[0];
-							if (--cur_len) memmove(kbd_buffer, kbd_buffer + 1, cur_len);
-							return (unsigned char)c;
-						}
-						else {
-							last_match = 0;
-							cur_key++;
-						}
-					}
-				}
-			}
-			/* If we have a partial match, let's look at stdin for escape_time
-				tenths of second. If nothing arrives, it is probably time to return
-				what we got. Note that this won't work properly if the terminal has
-				a key capability which is a prefix of another key capability. */
+#define TRIE_KEY(i) ((const unsigned char *)key[num_keys - 1 - (i)].string)
 
-			partial_match = true;
-		}
+/* Fills the subtrie rooted at node, whose characters are the first depth
+   characters of the keys with (increasing) indices from lo to hi. */
 
-		fflush(stdout);
+static void build_subtrie(const int node, const int depth, int lo, const int hi) {
+	for(; lo < hi && TRIE_KEY(lo)[depth] == 0; lo++)
+		if (trie[node].code < 0) trie[node].code = key[num_keys - 1 - lo].code;
 
-		if (partial_match) set_termios_timeout(escape_time);
+	int n = 0;
+	for(int i = lo; i < hi; i++) if (i == lo || TRIE_KEY(i)[depth] != TRIE_KEY(i - 1)[depth]) n++;
 
-		errno = 0;
-		c = getchar();
-		e = errno;
+	trie[node].first_child = trie_size;
+	trie[node].num_children = n;
+	trie_size += n;
 
-		if (partial_match) set_termios_timeout(0);
+	for(int i = lo, child = trie[node].first_child; i < hi; child++) {
+		int j = i + 1;
+		while(j < hi && TRIE_KEY(j)[depth] == TRIE_KEY(i)[depth]) j++;
+		trie[child].c = TRIE_KEY(i)[depth];
+		trie[child].code = -1;
+		build_subtrie(child, depth + 1, i, j);
+		i = j;
+	}
+}
 
-		/* This is necessary to circumvent the slightly different behaviour of getc() in Linux and BSD. */
-		clearerr(stdin);
+static void build_trie(void) {
+	size_t size = 1;
+	for(int i = 0; i < num_keys; i++) size += strlen(key[i].string);
 
-		if (c == EOF && (!partial_match || e) && e != EINTR) kill(getpid(), SIGTERM);
+	free(trie);
+	trie_size = 0;
+	if (!(trie = malloc(size * sizeof *trie))) return;
 
-		partial_match = false;
+	trie[0].code = -1;
+	trie_size = 1;
+	build_subtrie(0, 0, 0, num_keys);
+	trie_valid = true;
+}
 
-		if (c != EOF) {
-			if (cur_len < KBD_BUF_SIZE) kbd_buffer[cur_len++] = c;
-		}
-		else {
-			if (cur_len) {
-
-				/* We ran out of time. If our match was UTF-8, we discard the
-					partially received UTF-8 sequence. Otherwise, we return the
-					first character of the keyboard buffer.  */
-
-				if (partial_is_utf8) cur_len = last_match = partial_is_utf8 = 0;
-				else {
-					c = kbd_buffer[0];
-					if (--cur_len) memmove(kbd_buffer, kbd_buffer + 1, cur_len);
-					return (unsigned char)c;
+/* Returns the child of node corresponding to c, or -1. */
+
+static int trie_child(const int node, const unsigned char c) {
+	int l = trie[node].first_child, r = l + trie[node].num_children - 1;
+	while(l <= r) {
+		const int m = (l + r) / 2;
+		if (trie[m].c == c) return m;
+		if (trie[m].c < c) l = m + 1;
+		else r = m - 1;
+	}
+	return -1;
+}
+
+
+/* Reads in characters, and tries to match them with the sequences
+   corresponding to special keys. Returns a positive number, denoting
+   a character (possibly INVALID_CHAR), or a negative number denoting a key
+   code (if x is the key code, -x-1 will be returned).
+
+   Characters are read in bulk into a ring buffer, and matched by walking the
+   key trie. If the buffer contains a complete key, we return it (if a key is
+   a prefix of another one, the longest match wins); if no key starts with the
+   buffer contents, we give back the first character (the next call will retry
+   a match on the following characters). Otherwise, we wait for further
+   characters for at most escape_time tenths of second; if nothing arrives,
+   it is probably time to return what we got. */
+
+int get_key_code(void) {
+	if (!trie_valid) build_trie();
+	bool timed_out = false;
+
+	while(true) {
+		if (kbd_len) {
+			int c = (unsigned char)KBD(0);
+
+			if (io_utf8 && c >= 0x80) {
+				const int l = utf8len(c);
+				int i = 1;
+				while(i < l && i < kbd_len && (KBD(i) & 0xC0) == 0x80) i++;
+
+				if (l < 1 || i < l && i < kbd_len) {
+					/* A UTF-8 error. We discard the first character and try again. */
+					kbd_consume(1);
+					continue;
+				}
+				if (i == l) {
+					char s[8];
+					for(i = 0; i < l; i++) s[i] = KBD(i);
+					kbd_consume(l);
+					c = utf8char(s);
+					return c == -1 ? INVALID_CHAR : c;
+				}
+				if (timed_out) {
+					/* We discard the partially received UTF-8 sequence. */
+					kbd_consume(kbd_len);
+					timed_out = false;
+					continue;
 				}
 			}
+			else {
+				int node = trie_valid ? 0 : -1, len = 0, code = -1, code_len = 0;
+				while(node >= 0 && len < kbd_len && trie[node].num_children) {
+					if ((node = trie_child(node, KBD(len))) >= 0) {
+						len++;
+						if (trie[node].code >= 0) {
+							code = trie[node].code;
+							code_len = len;
+						}
+					}
+				}
+
+				if (node < 0 || !trie[node].num_children || timed_out) {
+					if (code >= 0) {
+						kbd_consume(code_len);
+						assert(code < NUM_KEYS);
+						return -code - 1;
+					}
+					kbd_consume(1);
+					return c;
+				}
+			}
+		}
+
+		/* We need more characters. If we have a partial match, we wait for
+			at most escape_time tenths of second. */
+
+		flush_frame();
+
+		const bool partial_match = kbd_len != 0;
+		const int r = fill_kbd_buffer(partial_match ? escape_time * 100 : -1);
+
+		if (r < 0 && errno != EINTR) kill(getpid(), SIGTERM);
+
+		if (r <= 0) {
+			if (partial_match) timed_out = true;
 			else return INVALID_CHAR;
 		}
 	}
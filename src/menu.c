@@ -408,7 +408,7 @@ static void undraw_menu(const int n) {
 		if (ld->ld_node.next->next) {
 			ld = (line_desc *)ld->ld_node.next;
 			if (cur_buffer->syn) parse(cur_buffer->syn, ld, ld->highlight_state, cur_buffer->encoding == ENC_UTF8);
-			output_line_desc(i, menus[n].xpos - 1, ld, cur_buffer->win_x + menus[n].xpos - 1, menus[n].width + (standout_ok ? MENU_EXTRA : MENU_NOSTANDOUT_EXTRA), cur_buffer->opt.tab_size, false, cur_buffer->encoding == ENC_UTF8, cur_buffer->syn ? attr_buf : NULL, NULL, 0);
+			output_line_desc(i, menus[n].xpos - 1, ld, cur_buffer->win_x + menus[n].xpos - 1, menus[n].width + (standout_ok ? MENU_EXTRA : MENU_NOSTANDOUT_EXTRA), cur_buffer->opt.tab_size, false, cur_buffer->encoding == ENC_UTF8, cur_buffer->syn ? &attr_buf : NULL, NULL, 0);
 		}
 		else {
 			move_cursor(i, menus[n].xpos - 1);
@@ -764,7 +764,7 @@ void print_message(const char * const message) {
 			standout_off();
 		}
 
-		fflush(stdout);
+		flush_frame();
 
 		showing_msg = true;
 	}
@@ -93,8 +93,11 @@ void resync_pos(buffer * const b) {
 	}
 
 	line_desc *ld = b->cur_line_desc;
-	int64_t i, pos, width, last_char_width;
-	for(i = pos = width = 0; pos < ld->line_len; pos = next_pos(ld->line, pos, b->encoding), i++) {
+	/* No character ending before column x can affect the result, so we start
+		from the last checkpoint before x. */
+	const line_checkpoint cp = line_checkpoint_at_col(ld, x - 1, b->opt.tab_size, b->encoding);
+	int64_t i = cp.chars, pos = cp.pos, width = cp.width, last_char_width;
+	for(; pos < ld->line_len; pos = next_pos(ld->line, pos, b->encoding), i++) {
 
 		if (ld->line[pos] != '\t') width += (last_char_width = get_char_width(&ld->line[pos], b->encoding));
 		else width += (last_char_width = b->opt.tab_size - width % b->opt.tab_size);
@@ -837,7 +840,9 @@ void move_to_eol(buffer * const b) {
 		return;
 	}
 
-	for(int64_t i = 0, pos = 0, width = 0; pos < ld->line_len; pos = next_pos(ld->line, pos, b->encoding), i++)  {
+	/* Characters ending at or before the first candidate column need not be scanned. */
+	const line_checkpoint cp = line_checkpoint_at_col(ld, total_width - ne_columns + b->opt.tab_size, b->opt.tab_size, b->encoding);
+	for(int64_t pos = cp.pos, width = cp.width; pos < ld->line_len; pos = next_pos(ld->line, pos, b->encoding))  {
 		if (ld->line[pos] != '\t') width += get_char_width(&ld->line[pos], b->encoding);
 		else width += b->opt.tab_size - width % b->opt.tab_size;
 
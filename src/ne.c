@@ -29,6 +29,7 @@
 #include <signal.h>
 #include <limits.h>
 #include <locale.h>
+#include <time.h>
 
 /* This is the array containing the "NO WARRANTY" message, which is displayed
    when ne is called without any specific file name or macro to execute. The
@@ -107,6 +108,7 @@ bool verbose_macros = true;
 
 buffer *cur_buffer;
 int turbo;
+int sync_lines = 50;
 bool do_syntax = true;
 
 /* Whether we are currently displaying an about message. */
@@ -441,16 +443,37 @@ int main(int argc, char **argv) {
 		about();
 	}
 
+	/* The last time the screen was brought up to date. */
+	struct timespec shown;
+	clock_gettime(CLOCK_MONOTONIC, &shown);
+
 	while(true) {
-		/* If we are displaying the "NO WARRANTY" info, we should not refresh the
-		   window now */
-		if (!displaying_info) {
-			refresh_window(cur_buffer);
-			if (cur_buffer->opt.automatch) automatch_bracket(cur_buffer, true);
-		}
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+
+		/* If more keys are already waiting (e.g., auto-repeat), we do not show
+		   the intermediate state: updates are delayed, and the next refresh
+		   will repaint in one go whatever changed in the meantime. */
+		if (key_pending() && (now.tv_sec - shown.tv_sec) * 1000 + (now.tv_nsec - shown.tv_nsec) / 1000000 < REDRAW_BUDGET) postpone_update();
+		else {
+			shown = now;
+
+			/* If we are displaying the "NO WARRANTY" info, we should not refresh the
+			   window now */
+			if (!displaying_info) {
+				refresh_window(cur_buffer);
+				if (cur_buffer->opt.automatch) automatch_bracket(cur_buffer, true);
+			}
 
-		draw_status_bar();
-		move_cursor(cur_buffer->cur_y, cur_buffer->cur_x);
+			draw_status_bar();
+			move_cursor(cur_buffer->cur_y, cur_buffer->cur_x);
+
+			/* While waiting for input, we compute the remaining syntax states. */
+			if (cur_buffer->syn && !cur_buffer->windowed_syntax && cur_buffer->syn_valid < cur_buffer->num_lines) {
+				flush_frame();
+				while(cur_buffer->syn_valid < cur_buffer->num_lines && !key_pending()) ensure_syntax_states(cur_buffer, cur_buffer->syn_valid + SYNTAX_IDLE_LINES);
+			}
+		}
 
 		int c = get_key_code();
 
@@ -489,7 +512,13 @@ int main(int argc, char **argv) {
 
 		case COMMAND:
 			if (c < 0) c = -c - 1;
-			if (key_binding[c]) print_error(execute_command_line(cur_buffer, key_binding[c]));
+			if (c == NE_KEY_PASTE) {
+				int64_t len;
+				char * const p = read_paste(&len);
+				print_error(p ? insert_paste(cur_buffer, p, len) : OUT_OF_MEMORY);
+				free(p);
+			}
+			else if (key_binding[c]) print_error(execute_command_line(cur_buffer, key_binding[c]));
 			break;
 
 		default:
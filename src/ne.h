@@ -94,6 +94,12 @@ extern const char *input_class_names[];
 
 #define SYNTAX_EXT         ".jsf"
 
+/* The name of the subdirectory of the local preferences directory containing
+   compiled syntax definitions, and their extension. */
+
+#define SYNTAX_CACHE_DIR   "syntax-cache"
+#define SYNTAX_CACHE_EXT   ".jsc"
+
 /* The name of the file containing the mappings from extensions to syntax names. */
 
 #define EXT_2_SYN          "ext2syn"
@@ -102,6 +108,17 @@ extern const char *input_class_names[];
 
 #define MAX_SYNTAX_SIZE		(10000000)
 
+/* The number of lines whose initial syntax state is computed at each step
+   while ne is waiting for input. */
+
+#define SYNTAX_IDLE_LINES	(4096)
+
+/* While more input is pending, the screen is not refreshed between actions
+   (so that all intermediate updates are merged in a single repaint), but
+   never for more than this number of milliseconds. */
+
+#define REDRAW_BUDGET		(100)
+
 /* This is the name taken by unnamed documents. */
 
 #define UNNAMED_NAME       "<unnamed>"
@@ -285,6 +302,20 @@ typedef struct {
 #endif
 
 
+/* This structure defines a checkpoint of a line: pos is a byte position, and
+   chars and width are the number of characters and the TAB-expanded width
+   of the line up to pos. Lines longer than LINE_INDEX_THRESHOLD bytes get a
+   lazily built index of checkpoints (see support.c), so that the
+   conversions between positions and columns need not scan the whole line. */
+
+#define LINE_INDEX_THRESHOLD (4096)
+
+typedef struct {
+	int64_t pos;
+	int64_t chars;
+	int64_t width;
+} line_checkpoint;
+
 
 /* This structure defines a pool of characters. size represents the size of
    the pool pointed by pool, while first_used and last_used represent
@@ -431,6 +462,7 @@ typedef struct {
 		del_tabs:1,        /* DEL/BS deletes tab's worth of space. */
 		shift_tabs:1,      /* Shift may insert tabs, but only if tabs is also true */
 		automatch:4,       /* Automatically match visible brackets */
+		highlight_matches:4, /* Highlight visible occurrences of the find string */
 		binary:1,          /* Load and save in binary mode */
 		utf8auto:1,        /* Try to detect automatically UTF-8 */
 		visual_bell:1;     /* Prefer visible bell to audible */
@@ -497,10 +529,14 @@ typedef struct {
 	int cur_bookmark;           /* For Goto(Next|Prev)Bookmark. */
 
 	struct high_syntax *syn;    /* Syntax loaded for this buffer. */
-	uint32_t *attr_buf;              /* If attr_len >= 0, a pointer to the list of *current* attributes of the *current* line. */ 
-	int64_t attr_size;              /* attr_buf size. */
+	attr_spans attr_buf;            /* If attr_len >= 0, the runs of *current* attributes of the *current* line. */
 	int64_t attr_len;               /* attr_buf valid number of characters, or -1 to denote that attr_buf is not valid. */
 	HIGHLIGHT_STATE next_state; /* If attr_len >= 0, the state after the *current* line. */
+	int64_t syn_valid;          /* Initial syntax states are valid for lines before this one (the watermark). */
+	int64_t syn_window_start;   /* ...and starting with this one (nonzero only if windowed_syntax is true). */
+	line_desc *syn_valid_ld;    /* The line descriptor of line syn_valid, or NULL if the watermark must be reset. */
+	int64_t syn_resume;         /* If greater than syn_valid, the watermark before it was moved back by an edit... */
+	line_desc *syn_resume_ld;   /* ...and its line descriptor (see ensure_syntax_states()). */
 
 	int link_undos;             /* Link the undo steps. Multilevel. */
 
@@ -519,7 +555,8 @@ typedef struct {
 		atomic_undo:1,           /* subsequent commands undo as a block */
 		executing_macro:1,       /* We are currently executing a macro. */
 		executing_internal_macro:1,  /* We are currently executing the internal macro of the current buffer */
-		is_CRLF:1;               /* Buffer should be saved with CR/LF terminators */
+		is_CRLF:1,               /* Buffer should be saved with CR/LF terminators */
+		windowed_syntax:1;       /* Syntax states are computed starting sync_lines above the visible lines */
 
 	unsigned int find_string_changed; /* 0 = unset; 1 = force; else prior search's serial number */
 
@@ -549,11 +586,14 @@ typedef struct {
 
 #define assert_buffer_content(b) {if ((b)) {\
 	line_desc *ld;\
+	int64_t line = 0;\
 	ld = (line_desc *)(b)->line_desc_list.head;\
 	while(ld->ld_node.next) {\
 		assert_line_desc(ld, (b)->encoding);\
-		if ((b)->syn) assert(ld->highlight_state.state != -1);\
+		if ((b)->syn && (b)->syn_valid_ld && line >= (b)->syn_window_start && line < (b)->syn_valid) assert(ld->highlight_state.state != -1);\
+		if ((b)->syn && (b)->syn_valid_ld && line == (b)->syn_valid) assert(ld == (b)->syn_valid_ld);\
 		ld = (line_desc *)ld->ld_node.next;\
+		line++;\
 	}\
 	if ((b)->syn) assert((b)->attr_len < 0 || (b)->attr_len == calc_char_len((b)->cur_line_desc, (b)->cur_line_desc->line_len, (b)->encoding));\
 }}
@@ -576,6 +616,11 @@ extern list buffers, clips, macros;
 
 extern int turbo;
 
+/* The number of lines parsed above the visible ones when highlighting files
+   larger than MAX_SYNTAX_SIZE, or 0 to disable highlighting for such files. */
+
+extern int sync_lines;
+
 
 /* If true, the current line has changed and care must be taken
    to update the initial state of the following lines. */
@@ -179,6 +179,7 @@ int save_prefs(buffer * const b, const char * const name) {
 		record_action(cs, DELTABS_A,          b->opt.del_tabs,       NULL, verbose_macros);
 		record_action(cs, SHIFTTABS_A,        b->opt.shift_tabs,     NULL, verbose_macros);
 		record_action(cs, AUTOMATCHBRACKET_A, b->opt.automatch,      NULL, verbose_macros);
+		record_action(cs, HIGHLIGHTMATCHES_A, b->opt.highlight_matches, NULL, verbose_macros);
 		record_action(cs, BINARY_A,           b->opt.binary,         NULL, verbose_macros);
 		record_action(cs, UTF8AUTO_A,         b->opt.utf8auto,       NULL, verbose_macros);
 		record_action(cs, VISUALBELL_A,       b->opt.visual_bell,    NULL, verbose_macros);
@@ -58,7 +58,6 @@ int insert_spaces(buffer *b, line_desc *ld, int64_t line, int64_t pos, int64_t n
 int delete_stream(buffer *b, line_desc *ld, int64_t line, int64_t pos, int64_t len);
 int delete_one_char(buffer *b, line_desc *ld, int64_t line, int64_t pos);
 void change_filename(buffer *b, char *name);
-void ensure_attr_buf(buffer * const b, const int64_t capacity);
 int load_file_in_buffer(buffer *b, const char *name);
 int load_fd_in_buffer(buffer *b, int fd);
 int save_buffer_to_file(buffer *b, const char *name);
@@ -74,6 +73,7 @@ clip_desc *get_nth_clip(int n);
 int copy_to_clip(buffer *b, int n, bool cut);
 int erase_block(buffer *b);
 int paste_to_buffer(buffer *b, int n);
+int insert_paste(buffer *b, char *p, int64_t len);
 int copy_vert_to_clip(buffer *b, int n, bool cut);
 int erase_vert_block(buffer *b);
 int paste_vert_to_buffer(buffer *b, int n);
@@ -101,7 +101,9 @@ void optimize_macro(char_stream *cs, bool verbose);
 void update_syntax_states(buffer *b, int row, line_desc *ld, line_desc *end_ld);
 int highlight_cmp(HIGHLIGHT_STATE *x, HIGHLIGHT_STATE *y);
 void delay_update();
-void output_line_desc(int row, int col, const line_desc *ld, int64_t start, int64_t len, int tab_size, bool cleared_at_end, bool utf8, const uint32_t * const attr, const uint32_t * const diff, const int64_t diff_size);
+void postpone_update(void);
+void refresh_postponed(buffer *b);
+void output_line_desc(int row, int col, const line_desc *ld, int64_t start, int64_t len, int tab_size, bool cleared_at_end, bool utf8, const attr_spans * const attr, const attr_spans * const diff, const int64_t diff_size);
 void update_line(buffer *b, line_desc *ld, int n, int64_t start_x, bool cleared_at_end);
 void update_window_lines(buffer *b, line_desc *ld, int start_line, int end_line, bool doit);
 void update_syntax_and_lines(buffer *b, line_desc *start_ld, line_desc *end_ld);
@@ -113,6 +115,7 @@ void reset_window(void);
 void refresh_window(buffer *b);
 void scroll_window(buffer *b, line_desc *ld, int line, int n);
 void ensure_attributes(buffer *b);
+void ensure_syntax_states(buffer *b, int64_t n);
 void store_attributes(buffer *b, line_desc *ld);
 void automatch_bracket(buffer * const b, const bool show);
 
@@ -151,6 +154,8 @@ const char *ext2syntax(const char * const ext);
 void read_key_capabilities(void);
 void set_escape_time(int new_escape_time);
 int get_key_code(void);
+bool key_pending(void);
+char *read_paste(int64_t *len);
 int key_may_set(const char * const cap_string, int code);
 
 /* menu.c */
@@ -248,6 +253,13 @@ int  find_regexp(buffer *b, const char *regex, const bool skip_first, bool wrap_
 int  replace_regexp(buffer *b, const char *string);
 char *nth_regex_substring(const line_desc *ld, int i);
 bool nth_regex_substring_nonempty(const line_desc *ld, int i);
+int  replace_all(buffer *b, int64_t *num_replace);
+int  grep(buffer *b, const char *pattern, const char *path, const bool regexp, int64_t *matches, int64_t *files);
+char *parse_grep_match(const line_desc *ld, int64_t *line);
+unsigned int highlight_serial(const buffer *b);
+int  find_line_matches(const line_desc *ld, const int64_t **start, const int64_t **end);
+void line_matches_invalidate(const line_desc *ld);
+void line_matches_flush(void);
 
 /* signals.c */
 void stop_ne(void);
@@ -302,6 +314,10 @@ encoding_type detect_encoding(const char *s, int64_t len);
 int context_prefix(const buffer *b, char **p, int64_t *prefix_pos);
 line_desc *nth_line_desc(const buffer *b, const int64_t n);
 const char *cur_bookmarks_string(const buffer *b);
+line_checkpoint line_checkpoint_at_pos(const line_desc *ld, const int64_t pos, const int tab_size, const encoding_type encoding);
+line_checkpoint line_checkpoint_at_col(const line_desc *ld, const int64_t col, const int tab_size, const encoding_type encoding);
+void line_index_invalidate(const line_desc *ld, const int64_t pos);
+void line_index_flush(void);
 
 /* undo.c */
 void start_undo_chain(buffer *b);
@@ -22,6 +22,8 @@
 #include "ne.h"
 #include "regex.h"
 #include "support.h"
+#include <dirent.h>
+#include <sys/mman.h>
 
 /* This is the initial allocation size for regex.library. */
 
@@ -83,6 +85,31 @@ const unsigned char ascii_up_case[256] = {
 
 
 
+/* Scans forward the characters in [p - m + 1..end) for the given pattern of
+   length m using the given Boyer-Moore table (usually d), which must have been
+   set up for forward searches. p must point m - 1 characters after the first candidate
+   position. Returns a pointer to the first occurrence, or NULL. */
+
+static const char *bm_search(const unsigned int * const skip, const char *p, const char * const end, const char * const pattern, const int m, const unsigned char * const up_case, const bool sense_case) {
+	const unsigned char first_char = CONV((unsigned char)pattern[m - 1]);
+
+	while(p < end) {
+		const unsigned char c = CONV((unsigned char)*p);
+		if (c != first_char) p += skip[c];
+		else {
+			int i;
+			for (i = 1; i < m; i++)
+				if (CONV((unsigned char)*(p - i)) != CONV((unsigned char)pattern[m - i-1])) {
+					p += skip[c];
+					break;
+				}
+			if (i == m) return p - m + 1;
+		}
+	}
+	return NULL;
+}
+
+
 /* Performs a search for the given pattern with a simplified Boyer-Moore
    algorithm starting at the given position, in the given direction, skipping a
    possible match at the current cursor position if skip_first is true. The
@@ -126,32 +153,16 @@ int find(buffer * const b, const char *pattern, const bool skip_first, bool wrap
 			b->find_string_changed = search_serial_num;
 		}
 
-		char * p = ld->line + b->cur_pos + m - 1 + (skip_first ? 1 : 0);
-		const unsigned char first_char = CONV((unsigned char)pattern[m - 1]);
+		const char * p = ld->line + b->cur_pos + m - 1 + (skip_first ? 1 : 0);
 		int64_t wrap_lines_left = b->num_lines + 1;
 
 		while(y < b->num_lines && !stop && wrap_lines_left--) {
 
 			assert(ld->ld_node.next != NULL);
 
-			if (ld->line_len >= m) {
-
-				while((p - ld->line) < ld->line_len) {
-					const unsigned char c = CONV((unsigned char)*p);
-					if (c != first_char) p += d[c];
-					else {
-						int i;
-						for (i = 1; i < m; i++)
-							if (CONV((unsigned char)*(p - i)) != CONV((unsigned char)pattern[m - i-1])) {
-								p += d[c];
-								break;
-							}
-						if (i == m) {
-							goto_line_pos(b, y, (p - ld->line) - m + 1);
-							return OK;
-						}
-					}
-				}
+			if (ld->line_len >= m && (p = bm_search(d, p, ld->line + ld->line_len, pattern, m, up_case, sense_case))) {
+				goto_line_pos(b, y, p - ld->line);
+				return OK;
 			}
 
 			ld = (line_desc *)ld->ld_node.next;
@@ -279,6 +290,197 @@ static struct re_registers re_reg;
 static int map_group[RE_NREGS];
 static int use_map_group;
 
+/* Freshly loaded text lies in a single character pool, with lines separated
+   by NULs. find_regexp() exploits this fact by scanning at once spans of up to
+   REGEX_SPAN_LINES consecutive lines that are still in place (see
+   collect_span()) using re_span_pb, which is compiled together with re_pb but
+   translates NULs into newlines, so that line boundaries act as anchors.
+   span_ld and span_pos record the lines of the current span and their
+   offsets from the start of the span. */
+
+#define REGEX_SPAN_LINES (1024)
+
+static struct re_pattern_buffer re_span_pb;
+static bool re_span_pb_ok;
+static unsigned char span_translate[256];
+static char span_fastmap[256];
+static line_desc *span_ld[REGEX_SPAN_LINES];
+static int64_t span_pos[REGEX_SPAN_LINES];
+
+/* If we are matching UTF-8 text, we need to replace dots with UTF8DOT,
+   non-word-constituents (\W) with UTF8NONWORD, and embed complemented
+   character classes in UTF8COMP, so that they do not match UTF-8
+   subsequences. This function stores in *actual_regex a newly allocated copy
+   of regex rewritten in this way. Moreover, if map_groups is true, it
+   computes the remapping from the virtual to the actual groups caused by the
+   new groups thus introduced. */
+
+static int utf8_regex(const char * const regex, char ** const actual_regex, const bool map_groups) {
+	const char *s;
+	char *q;
+	bool escape = false;
+	int virtual_group = 0, real_group = 0, dots = 0, comps = 0, nonwords = 0, use_map_group = 0;
+
+	s = regex;
+
+	/* We first scan regex to compute the exact number of characters of
+		the actual (i.e., after substitutions) regex. */
+
+	do {
+		if (!escape) {
+			if (*s == '.') dots++;
+			else if (*s == '[') {
+				if (*(s+1) == '^') {
+					comps++;
+					s++;
+				}
+
+				if (*(s+1) == ']') s++; /* A literal ]. */
+
+				/* We scan the list up to ] and check that no non-US-ASCII characters appear. */
+				do if (utf8len(*(++s)) != 1) return UTF8_REGEXP_CHARACTER_CLASS_NOT_SUPPORTED; while(*s && *s != ']');
+			}
+			else if (*s == '\\') {
+				escape = true;
+				continue;
+			}
+		}
+		else if (*s == 'W') nonwords++;
+		escape = false;
+	} while(*(++s));
+
+	*actual_regex = q = malloc(strlen(regex) + 1 + (strlen(UTF8DOT) - 1) * dots + (strlen(UTF8NONWORD) - 2) * nonwords + (strlen(UTF8COMP) - 1) * comps);
+	if (!q) return OUT_OF_MEMORY;
+	s = regex;
+	escape = false;
+
+	do {
+		if (escape || *s != '.' && *s != '(' && *s != '[' && *s != '\\') {
+			if (escape && *s == 'W') {
+				q--;
+				strcpy(q, UTF8NONWORD);
+				q += strlen(UTF8NONWORD);
+				real_group++;
+			}
+			else *(q++) = *s;
+		}
+		else {
+			if (*s == '\\') {
+				escape = true;
+				*(q++) = '\\';
+				continue;
+			}
+
+			if (*s == '.') {
+				strcpy(q, UTF8DOT);
+				q += strlen(UTF8DOT);
+				real_group++;
+			}
+			else if (*s == '(') {
+				*(q++) = '(';
+				if (map_groups && virtual_group < RE_NREGS - 1) {
+					map_group[++virtual_group] = ++real_group;
+					use_map_group = virtual_group;
+				}
+			}
+			else if (*s == '[') {
+				if (*(s+1) == '^') {
+					strcpy(q, UTF8COMP);
+					q += strlen(UTF8COMP);
+					s++;
+					if (*(s+1) == ']') *(q++) = *(++s); /* A literal ]. */
+					do *(q++) = *(++s); while (*s && *s != ']');
+					if (*s) *(q++) = ')';
+					real_group++;
+				}
+				else {
+					*(q++) = '[';
+					if (*(s+1) == ']') *(q++) = *(++s); /* A literal ]. */
+					do *(q++) = *(++s); while (*s && *s != ']');
+				}
+			}
+		}
+
+		escape = false;
+	} while(*(s++));
+
+	/* This assert may be false if a [ is not closed. */
+	assert(strlen(*actual_regex) == strlen(regex) + (strlen(UTF8DOT) - 1) * dots + (strlen(UTF8NONWORD) - 2) * nonwords + (strlen(UTF8COMP) - 1) * comps);
+
+	return OK;
+}
+
+
+/* Compiles the given regular expression into re_pb (and re_span_pb),
+   rewriting it first with utf8_regex() if utf8 is true. The translation table
+   must have been already set. */
+
+static int compile_regexp(const char * const regex, const bool utf8) {
+	char *actual_regex = (char *)regex;
+
+	if (utf8) {
+		const int error = utf8_regex(regex, &actual_regex, true);
+		if (error) return error;
+	}
+
+	const char * p = re_compile_pattern(actual_regex, strlen(actual_regex), &re_pb);
+
+	re_span_pb_ok = false;
+	if (!p) {
+		if (re_span_pb.buffer == NULL && (re_span_pb.buffer = malloc(START_BUFFER_SIZE))) re_span_pb.allocated = START_BUFFER_SIZE;
+		if (re_span_pb.buffer != NULL) {
+			for(int i = 0; i < sizeof span_translate; i++) span_translate[i] = re_pb.translate ? re_pb.translate[i] : i;
+			span_translate[0] = '\n';
+			re_span_pb.translate = span_translate;
+			re_span_pb.fastmap = span_fastmap;
+			re_span_pb_ok = re_compile_pattern(actual_regex, strlen(actual_regex), &re_span_pb) == NULL;
+		}
+	}
+
+	if (utf8) free(actual_regex);
+
+	if (p) {
+		/* Here we have a very dirty hack: since we cannot return the error of
+			regex, we print it here. Which means that we access term.c's
+			functions. 8^( */
+		print_message(p);
+		alert();
+		return ERROR;
+	}
+
+	return OK;
+}
+
+
+/* Collects in span_ld and span_pos at most max_lines consecutive lines,
+   starting from ld (which must not be empty), that lie in order in the same
+   character pool, separated just by one or two NULs (a CR/LF pair). Empty lines
+   are placed right after a NUL. Returns the number of lines collected. */
+
+static int collect_span(buffer * const b, line_desc *ld, int64_t max_lines) {
+	if (!ld->line) return 0;
+
+	const char_pool * const cp = get_char_pool(b, ld->line);
+	const char * const base = ld->line, * const end = cp->pool + cp->size;
+	const char *p = base;
+	int n;
+
+	if (max_lines > REGEX_SPAN_LINES) max_lines = REGEX_SPAN_LINES;
+
+	for(n = 0; n < max_lines && ld->ld_node.next; n++, ld = (line_desc *)ld->ld_node.next) {
+		const char * const q = ld->line ? ld->line : p + 1;
+		if (n) {
+			if (q <= p || q - p > 2 || q + ld->line_len > end || *p || q - p == 2 && p[1]) break;
+		}
+		span_ld[n] = ld;
+		span_pos[n] = q - base;
+		p = q + ld->line_len;
+	}
+
+	return n;
+}
+
+
 /* Works exactly like find(), but uses the regex library instead. */
 
 int find_regexp(buffer * const b, const char *regex, const bool skip_first, bool wrap_once) {
@@ -319,120 +521,8 @@ int find_regexp(buffer * const b, const char *regex, const bool skip_first, bool
 	}
 
 	if (recompile_string) {
-		const char *actual_regex = regex;
-
-		/* If the buffer encoding is UTF-8, we need to replace dots with UTF8DOT,
-			non-word-constituents (\W) with UTF8NONWORD, and embed complemented
-			character classes in UTF8COMP, so that they do not match UTF-8
-			subsequences. Moreover, we must compute the remapping from the virtual
-			to the actual groups caused by the new groups thus introduced. */
-
-		if (b->encoding == ENC_UTF8) {
-			const char *s;
-			char *q;
-			bool escape = false;
-			int virtual_group = 0, real_group = 0, dots = 0, comps = 0, nonwords = 0, use_map_group = 0;
-
-			s = regex;
-
-			/* We first scan regex to compute the exact number of characters of
-				the actual (i.e., after substitutions) regex. */
-
-			do {
-				if (!escape) {
-					if (*s == '.') dots++;
-					else if (*s == '[') {
-						if (*(s+1) == '^') {
-							comps++;
-							s++;
-						}
-
-						if (*(s+1) == ']') s++; /* A literal ]. */
-
-						/* We scan the list up to ] and check that no non-US-ASCII characters appear. */
-						do if (utf8len(*(++s)) != 1) return UTF8_REGEXP_CHARACTER_CLASS_NOT_SUPPORTED; while(*s && *s != ']');
-					}
-					else if (*s == '\\') {
-						escape = true;
-						continue;
-					}
-				}
-				else if (*s == 'W') nonwords++;
-				escape = false;
-			} while(*(++s));
-
-			actual_regex = q = malloc(strlen(regex) + 1 + (strlen(UTF8DOT) - 1) * dots + (strlen(UTF8NONWORD) - 2) * nonwords + (strlen(UTF8COMP) - 1) * comps);
-			if (!actual_regex) return OUT_OF_MEMORY;
-			s = regex;
-			escape = false;
-
-			do {
-				if (escape || *s != '.' && *s != '(' && *s != '[' && *s != '\\') {
-					if (escape && *s == 'W') {
-						q--;
-						strcpy(q, UTF8NONWORD);
-						q += strlen(UTF8NONWORD);
-						real_group++;
-					}
-					else *(q++) = *s;
-				}
-				else {
-					if (*s == '\\') {
-						escape = true;
-						*(q++) = '\\';
-						continue;
-					}
-
-					if (*s == '.') {
-						strcpy(q, UTF8DOT);
-						q += strlen(UTF8DOT);
-						real_group++;
-					}
-					else if (*s == '(') {
-						*(q++) = '(';
-						if (virtual_group < RE_NREGS - 1) {
-							map_group[++virtual_group] = ++real_group;
-							use_map_group = virtual_group;
-						}
-					}
-					else if (*s == '[') {
-						if (*(s+1) == '^') {
-							strcpy(q, UTF8COMP);
-							q += strlen(UTF8COMP);
-							s++;
-							if (*(s+1) == ']') *(q++) = *(++s); /* A literal ]. */
-							do *(q++) = *(++s); while (*s && *s != ']');
-							if (*s) *(q++) = ')';
-							real_group++;
-						}
-						else {
-							*(q++) = '[';
-							if (*(s+1) == ']') *(q++) = *(++s); /* A literal ]. */
-							do *(q++) = *(++s); while (*s && *s != ']');
-						}
-					}
-				}
-
-				escape = false;
-			} while(*(s++));
-
-			/* This assert may be false if a [ is not closed. */
-			assert(strlen(actual_regex) == strlen(regex) + (strlen(UTF8DOT) - 1) * dots + (strlen(UTF8NONWORD) - 2) * nonwords + (strlen(UTF8COMP) - 1) * comps);
-		}
-
-		const char * p = re_compile_pattern(actual_regex, strlen(actual_regex), &re_pb);
-
-		if (b->encoding == ENC_UTF8) free((void*)actual_regex);
-
-		if (p) {
-			/* Here we have a very dirty hack: since we cannot return the error of
-				regex, we print it here. Which means that we access term.c's
-				functions. 8^( */
-			print_message(p);
-			alert();
-			return ERROR;
-		}
-
+		const int error = compile_regexp(regex, b->encoding == ENC_UTF8);
+		if (error) return error;
 	}
 
 	b->find_string_changed = search_serial_num;
@@ -446,19 +536,52 @@ int find_regexp(buffer * const b, const char *regex, const bool skip_first, bool
 		int64_t start_pos = b->cur_pos + (skip_first ? 1 : 0);
 		int64_t wrap_lines_left = b->num_lines + 1;
 
-		while(y < b->num_lines && !stop && wrap_lines_left--) {
+		while(y < b->num_lines && !stop && wrap_lines_left > 0) {
 			assert(ld->ld_node.next != NULL);
 
 			int64_t pos;
-			if (start_pos <= ld->line_len &&
-				 (pos = re_search(&re_pb, ld->line ? ld->line : "", ld->line_len, start_pos, ld->line_len - start_pos, &re_reg)) >= 0) {
-				goto_line_pos(b, y, pos);
-				return OK;
+			int n = re_span_pb_ok ? collect_span(b, ld, wrap_lines_left) : 0;
+
+			if (n > 1) {
+				/* We scan the whole span. If there is a match, we match again on
+					the line containing it to get the actual registers (a match on
+					the span might cross a line boundary, in which case we go on
+					from the next line). */
+				const int64_t len = span_pos[n - 1] + span_ld[n - 1]->line_len, from = start_pos <= ld->line_len ? start_pos : span_pos[1];
+				if ((pos = re_search(&re_span_pb, ld->line, len, from, len - from, NULL)) >= 0) {
+					int l = 0, r = n - 1;
+					while(l < r) {
+						const int m = (l + r + 1) / 2;
+						if (span_pos[m] <= pos) l = m;
+						else r = m - 1;
+					}
+
+					line_desc * const match_ld = span_ld[l];
+					const int64_t match_pos = pos - span_pos[l];
+					if (match_pos <= match_ld->line_len &&
+						 (pos = re_search(&re_pb, match_ld->line ? match_ld->line : "", match_ld->line_len, match_pos, match_ld->line_len - match_pos, &re_reg)) >= 0) {
+						goto_line_pos(b, y + l, pos);
+						return OK;
+					}
+					n = l + 1;
+				}
+				else if (pos < -1) n = 0;
 			}
+			else n = 0;
 
-			ld = (line_desc *)ld->ld_node.next;
+			if (n == 0) {
+				if (start_pos <= ld->line_len &&
+					 (pos = re_search(&re_pb, ld->line ? ld->line : "", ld->line_len, start_pos, ld->line_len - start_pos, &re_reg)) >= 0) {
+					goto_line_pos(b, y, pos);
+					return OK;
+				}
+				n = 1;
+			}
+
+			wrap_lines_left -= n;
+			y += n;
+			while(n-- != 0) ld = (line_desc *)ld->ld_node.next;
 			start_pos = 0;
-			y++;
 			if (wrap_once && y == b->num_lines) {
 				wrap_once = false;
 				ld = (line_desc *)b->line_desc_list.head;
@@ -633,3 +756,420 @@ int replace_regexp(buffer * const b, const char * const string) {
 	last_replace_empty_match = re_reg.start[0] == re_reg.end[0];
 	return OK;
 }
+
+
+/* Replaces all occurrences of the find string of the given buffer (a regular
+   expression if b->last_was_regexp is true) with its replace string, starting
+   from the beginning of the document and ignoring the back search flag. All
+   replacements form a single undo chain, and no screen update is performed
+   (syntax states are recomputed at the end). The cursor is moved back to its
+   original line and column. The number of replacements is stored in
+   *num_replace. */
+
+int replace_all(buffer * const b, int64_t * const num_replace) {
+	assert(b->find_string != NULL);
+	assert(b->replace_string != NULL);
+
+	const encoding_type replace_encoding = detect_encoding(b->replace_string, strlen(b->replace_string));
+	const int64_t line = b->cur_line, col = b->win_x + b->cur_x;
+	const int search_back = b->opt.search_back;
+	int error;
+
+	*num_replace = 0;
+	b->opt.search_back = false;
+	b->find_string_changed = 1;
+	goto_line_pos(b, 0, 0);
+
+	start_undo_chain(b);
+
+	while(!stop && !(error = (b->last_was_regexp ? find_regexp : find)(b, NULL, false, false))) {
+		/* We delay buffer encoding promotion until it is really necessary. */
+		if (b->encoding == ENC_ASCII) b->encoding = replace_encoding;
+
+		if (error = b->last_was_regexp ? replace_regexp(b, b->replace_string) : replace(b, strlen(b->find_string), b->replace_string)) break;
+		(*num_replace)++;
+
+		if (last_replace_empty_match && char_right(b)) break;
+	}
+
+	end_undo_chain(b);
+
+	b->opt.search_back = search_back;
+	b->find_string_changed = 1;
+	if (stop) error = STOPPED;
+
+	if (*num_replace) reset_syntax_states(b);
+
+	goto_line_pos(b, line < b->num_lines ? line : b->num_lines - 1, 0);
+	goto_column(b, col);
+
+	return error == NOT_FOUND ? OK : error;
+}
+
+
+/* Grep support. The results of a Grep are accumulated in a stream of
+   NUL-separated lines (as expected by insert_stream()), which is inserted into
+   a new document at the end of the search. */
+
+static char *grep_stream;
+static int64_t grep_len, grep_size, grep_matches, grep_files;
+
+static int grep_append(const char * const s, const int64_t len) {
+	if (grep_len + len > grep_size) {
+		const int64_t size = (grep_len + len) * 2 + START_BUFFER_SIZE;
+		char * const p = realloc(grep_stream, size);
+		if (!p) return OUT_OF_MEMORY;
+		grep_stream = p;
+		grep_size = size;
+	}
+	memcpy(grep_stream + grep_len, s, len);
+	grep_len += len;
+	return OK;
+}
+
+
+/* Appends to the Grep results the line delimited by [s..e) of the given file. */
+
+static int grep_add_line(const char * const name, const int64_t line, const char * const s, const char *e) {
+	char t[32];
+	int error;
+
+	if (e > s && e[-1] == '\r') e--;
+	const int n = snprintf(t, sizeof t, ":%" PRId64 ":", line + 1);
+	grep_matches++;
+
+	if ((error = grep_append(name, strlen(name))) || (error = grep_append(t, n))) return error;
+	if (error = grep_append(s, strnlen_ne(s, e - s))) return error;
+	return grep_append("", 1);
+}
+
+
+/* Scans the given text (a memory-mapped file) line by line, using the regex
+   compiled in re_pb if regexp is true, or the Boyer-Moore table d for the
+   pattern of length m otherwise. In the latter case we scan the whole text at
+   once and count newlines only when a match is found. */
+
+static int grep_text(const char * const name, const char * const text, const size_t len, const char * const pattern, const int m, const bool regexp, const unsigned char * const up_case, const bool sense_case) {
+	const char * const end = text + len;
+	const char *s = text, *e;
+	const int64_t matches = grep_matches;
+	int64_t line = 0;
+	int error = OK;
+
+	if (regexp) {
+		for(; s < end && !stop && !error; s = e + 1, line++) {
+			if (!(e = memchr(s, '\n', end - s))) e = end;
+			if (re_search(&re_pb, s, e - s, 0, e - s, NULL) >= 0) error = grep_add_line(name, line, s, e);
+		}
+	}
+	else {
+		const char *q;
+		while(!stop && !error && (q = bm_search(d, s + m - 1, end, pattern, m, up_case, sense_case))) {
+			for(; e = memchr(s, '\n', q - s); s = e + 1) line++;
+			if (!(e = memchr(q, '\n', end - q))) e = end;
+			error = grep_add_line(name, line, s, e);
+			/* The pattern cannot contain a newline, so we restart from the next line. */
+			if (e == end) break;
+			s = e + 1;
+			line++;
+		}
+	}
+
+	if (grep_matches > matches) grep_files++;
+	return error;
+}
+
+
+/* Greps the given file, or recursively all files in the given directory.
+   Symbolic links are followed only if follow is true (i.e., for the path
+   specified by the user), and files that look binary (i.e., contain a NUL in
+   their first block) or cannot be read are skipped silently. */
+
+#define GREP_BINARY_CHECK (4 * 1024)
+
+static int grep_path(const char * const path, const bool follow, const char * const pattern, const int m, const bool regexp, const unsigned char * const up_case, const bool sense_case) {
+	struct stat statbuf;
+	int error = OK;
+
+	if (stop) return STOPPED;
+	if ((follow ? stat : lstat)(path, &statbuf)) return OK;
+
+	if (S_ISDIR(statbuf.st_mode)) {
+		DIR * const dir = opendir(path);
+		if (!dir) return OK;
+
+		const size_t path_len = strlen(path);
+		const struct dirent *de;
+		while(!error && (de = readdir(dir))) {
+			if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, "..")) continue;
+
+			char * const name = malloc(path_len + strlen(de->d_name) + 2);
+			if (!name) {
+				error = OUT_OF_MEMORY;
+				break;
+			}
+			if (!strcmp(path, ".")) strcpy(name, de->d_name);
+			else sprintf(name, path[path_len - 1] == '/' ? "%s%s" : "%s/%s", path, de->d_name);
+			error = grep_path(name, false, pattern, m, regexp, up_case, sense_case);
+			free(name);
+		}
+
+		closedir(dir);
+		return error;
+	}
+
+	if (!S_ISREG(statbuf.st_mode) || statbuf.st_size == 0 || statbuf.st_size > SIZE_MAX) return OK;
+
+	const int fd = open(path, READ_FLAGS);
+	if (fd < 0) return OK;
+
+	const size_t len = statbuf.st_size;
+	const char * const text = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (text == MAP_FAILED) return OK;
+
+	if (!memchr(text, 0, len < GREP_BINARY_CHECK ? len : GREP_BINARY_CHECK))
+		error = grep_text(path, text, len, pattern, m, regexp, up_case, sense_case);
+
+	munmap((void *)text, len);
+	return error;
+}
+
+
+/* Searches for the given pattern (a regular expression if regexp is true) in
+   the file, or in the directory tree, specified by path, using the case
+   sensitivity and the encoding of the given buffer. Files are memory mapped and
+   scanned with the same matchers of find() and find_regexp(). If there are
+   matches, a new document containing a line of the form file:line:text for
+   each of them is created and made current (see parse_grep_match()). The
+   number of matches and of matching files are stored in *matches and *files. */
+
+int grep(buffer * const b, const char * const pattern, const char * const path, const bool regexp, int64_t * const matches, int64_t * const files) {
+	const int m = strlen(pattern);
+	int error;
+
+	if (!m) return ERROR;
+
+	const bool utf8 = b->encoding == ENC_UTF8 || detect_encoding(pattern, m) == ENC_UTF8;
+	const unsigned char * const up_case = utf8 ? ascii_up_case : localised_up_case;
+	const bool sense_case = (b->opt.case_search != 0);
+
+	/* We are going to overwrite the compiled search data, so we force
+	   find() and find_regexp() to recompile. */
+	search_serial_num = ((search_serial_num & ~1) + 2)|2;
+
+	if (regexp) {
+		if (re_pb.buffer == NULL) {
+			if (re_pb.buffer = malloc(START_BUFFER_SIZE)) re_pb.allocated = START_BUFFER_SIZE;
+			else return OUT_OF_MEMORY;
+		}
+
+		re_pb.fastmap = (void *)d;
+		re_pb.translate = sense_case ? 0 : (unsigned char *)up_case;
+		if (error = compile_regexp(pattern, utf8)) return error;
+	}
+	else {
+		for(int i = 0; i < sizeof d / sizeof *d; i++) d[i] = m;
+		for(int i = 0; i < m - 1; i++) d[CONV((unsigned char)pattern[i])] = m - i-1;
+	}
+
+	grep_len = grep_matches = grep_files = 0;
+	stop = false;
+
+	error = grep_path(path, true, pattern, m, regexp, up_case, sense_case);
+	if (!error && stop) error = STOPPED;
+
+	if (!error && grep_matches) {
+		buffer * const gb = new_buffer();
+		if (gb) {
+			const bool do_undo = gb->opt.do_undo;
+			gb->opt.do_undo = false;
+			gb->encoding = detect_encoding(grep_stream, grep_len);
+			/* We do not insert the final NUL, to avoid an empty last line. */
+			error = insert_stream(gb, gb->cur_line_desc, 0, 0, grep_stream, grep_len - 1);
+			gb->opt.do_undo = do_undo;
+			gb->is_modified = false;
+		}
+		else error = OUT_OF_MEMORY;
+	}
+
+	*matches = grep_matches;
+	*files = grep_files;
+	free(grep_stream);
+	grep_stream = NULL;
+	grep_size = 0;
+	return error;
+}
+
+
+/* Parses a line of the form file:line:text produced by grep(). Returns a
+   newly allocated copy of the file name, storing the line number in *line, or
+   NULL if the line has not the expected form. */
+
+char *parse_grep_match(const line_desc * const ld, int64_t * const line) {
+	for(int64_t i = 1; i < ld->line_len; i++) {
+		if (ld->line[i] != ':') continue;
+
+		int64_t j, n = 0;
+		for(j = i + 1; j < ld->line_len && isdigit((unsigned char)ld->line[j]); j++) n = n * 10 + ld->line[j] - '0';
+
+		if (j > i + 1 && j < ld->line_len && ld->line[j] == ':') {
+			char * const name = malloc(i + 1);
+			if (name) {
+				memcpy(name, ld->line, i);
+				name[i] = 0;
+				*line = n;
+			}
+			return name;
+		}
+	}
+	return NULL;
+}
+
+
+/* Match highlighting. The find string of the current buffer is compiled
+   separately into hl_skip or re_hl_pb, so as not to interfere with find() and
+   find_regexp() (in particular, with the registers used by replace_regexp()).
+   hl_serial is incremented at each compilation. The occurrences in a line are
+   cached in a small direct-mapped table indexed by line descriptor, and are
+   recomputed only if the pattern has changed, or if the entry has been
+   invalidated by a modification of the line (see line_matches_invalidate()). */
+
+#define HL_CACHE_SIZE (256)
+#define HL_CACHE_HASH(ld) (((uintptr_t)(ld) / sizeof(no_syntax_line_desc)) % HL_CACHE_SIZE)
+
+static struct re_pattern_buffer re_hl_pb;
+static struct re_registers hl_reg;
+static unsigned int hl_skip[256];
+static char hl_fastmap[256];
+static char *hl_pattern;
+static bool hl_regexp, hl_sense_case, hl_utf8, hl_valid;
+static unsigned int hl_serial;
+
+static struct {
+	const line_desc *ld;
+	unsigned int serial;
+	int64_t *start, *end;
+	int n, size;
+} hl_cache[HL_CACHE_SIZE];
+
+
+/* Returns a nonzero serial number identifying the compiled form of the find
+   string of the given buffer, compiling it if necessary, or 0 if match
+   highlighting is disabled, or if there is no valid find string. */
+
+unsigned int highlight_serial(const buffer * const b) {
+	if (!b->opt.highlight_matches || !b->find_string || !*b->find_string) return 0;
+
+	const bool regexp = b->last_was_regexp, sense_case = b->opt.case_search, utf8 = b->encoding == ENC_UTF8;
+	if (hl_pattern && regexp == hl_regexp && sense_case == hl_sense_case && utf8 == hl_utf8 && !strcmp(hl_pattern, b->find_string)) return hl_valid ? hl_serial : 0;
+
+	char * const pattern = str_dup(b->find_string);
+	if (!pattern) return 0;
+
+	free(hl_pattern);
+	hl_pattern = pattern;
+	hl_regexp = regexp;
+	hl_sense_case = sense_case;
+	hl_utf8 = utf8;
+	hl_valid = false;
+	if (++hl_serial == 0) hl_serial = 1;
+
+	const unsigned char * const up_case = utf8 ? ascii_up_case : localised_up_case;
+
+	if (regexp) {
+		if (re_hl_pb.buffer == NULL) {
+			if (re_hl_pb.buffer = malloc(START_BUFFER_SIZE)) re_hl_pb.allocated = START_BUFFER_SIZE;
+			else return 0;
+		}
+
+		re_hl_pb.fastmap = hl_fastmap;
+		re_hl_pb.translate = sense_case ? 0 : (unsigned char *)up_case;
+
+		char *actual_regex = pattern;
+		if (utf8 && utf8_regex(pattern, &actual_regex, false)) return 0;
+		hl_valid = re_compile_pattern(actual_regex, strlen(actual_regex), &re_hl_pb) == NULL;
+		if (utf8) free(actual_regex);
+	}
+	else {
+		const int m = strlen(pattern);
+		for(int i = 0; i < sizeof hl_skip / sizeof *hl_skip; i++) hl_skip[i] = m;
+		for(int i = 0; i < m - 1; i++) hl_skip[CONV((unsigned char)pattern[i])] = m - i-1;
+		hl_valid = true;
+	}
+
+	return hl_valid ? hl_serial : 0;
+}
+
+
+/* Stores in *start and *end the starting and ending positions of the
+   nonoverlapping, nonempty occurrences in ld of the pattern compiled by the
+   last call to highlight_serial() (which must have returned a nonzero value),
+   and returns their number. */
+
+int find_line_matches(const line_desc * const ld, const int64_t ** const start, const int64_t ** const end) {
+	const int h = HL_CACHE_HASH(ld);
+
+	if (hl_cache[h].ld != ld || hl_cache[h].serial != hl_serial) {
+		const char * const line = ld->line ? ld->line : "";
+		const int64_t len = ld->line_len;
+
+		hl_cache[h].ld = ld;
+		hl_cache[h].serial = hl_serial;
+		hl_cache[h].n = 0;
+
+		int64_t s, e, pos = 0;
+		for(;;) {
+			if (hl_regexp) {
+				if (pos > len || (s = re_search(&re_hl_pb, line, len, pos, len - pos, &hl_reg)) < 0) break;
+				e = hl_reg.end[0];
+				if (e == s) {
+					pos = s + 1;
+					continue;
+				}
+			}
+			else {
+				const int m = strlen(hl_pattern);
+				const unsigned char * const up_case = hl_utf8 ? ascii_up_case : localised_up_case;
+				const bool sense_case = hl_sense_case;
+				const char *p;
+				if (len - pos < m || !(p = bm_search(hl_skip, line + pos + m - 1, line + len, hl_pattern, m, up_case, sense_case))) break;
+				s = p - line;
+				e = s + m;
+			}
+
+			if (hl_cache[h].n == hl_cache[h].size) {
+				const int size = hl_cache[h].size ? hl_cache[h].size * 2 : 8;
+				int64_t * const p = realloc(hl_cache[h].start, size * sizeof *p), * const q = p ? realloc(hl_cache[h].end, size * sizeof *q) : NULL;
+				if (p) hl_cache[h].start = p;
+				if (!q) break;
+				hl_cache[h].end = q;
+				hl_cache[h].size = size;
+			}
+
+			hl_cache[h].start[hl_cache[h].n] = s;
+			hl_cache[h].end[hl_cache[h].n++] = e;
+			pos = e;
+		}
+	}
+
+	*start = hl_cache[h].start;
+	*end = hl_cache[h].end;
+	return hl_cache[h].n;
+}
+
+/* Discards the cached occurrences in the given line descriptor. It must be
+   called whenever the content of a line descriptor changes, or the line
+   descriptor is freed. */
+
+void line_matches_invalidate(const line_desc * const ld) {
+	const int h = HL_CACHE_HASH(ld);
+	if (hl_cache[h].ld == ld) hl_cache[h].ld = NULL;
+}
+
+/* Discards all cached occurrences (e.g., when a pool of line descriptors is
+   freed). */
+
+void line_matches_flush(void) {
+	for(int i = 0; i < HL_CACHE_SIZE; i++) hl_cache[i].ld = NULL;
+}
@@ -520,13 +520,13 @@ void unset_interactive_mode(void) {
 	clear_to_eol();
 	move_cursor(ne_lines - 1, 0);
 
-	/* Now we disable the keypad, cursor addressing, etc. fflush() guarantees
+	/* Now we disable the keypad, cursor addressing, etc. flush_frame() guarantees
 		that tcsetattr() won't clip part of the capability strings output by
 		reset_terminal_modes(). */
 
 	reset_terminal_modes();
-	putchar('\r');
-	fflush(stdout);
+	ne_putchar('\r');
+	flush_frame();
 
 	/* Now we restore all the flags in the termios structure to the state they
 		were before us. */
@@ -697,3 +697,125 @@ const char *cur_bookmarks_string(const buffer *b) {
 	if (s > str) *(--s) = '\0';
 	return str;
 }
+
+
+/* The line index. For lines longer than LINE_INDEX_THRESHOLD bytes, a small
+   direct-mapped table indexed by line descriptor keeps a checkpoint every
+   LINE_INDEX_STEP characters (the first checkpoint is always the start of
+   the line). Checkpoints are computed lazily, only as far as required by the
+   query at hand. Since an edit does not change the part of a line before
+   it, edits just truncate the index of the line involved at the edit
+   position (see line_index_invalidate()). When a pool of line descriptors
+   is freed the whole table is flushed, as the addresses could be reused. */
+
+#define LINE_INDEX_SIZE (16)
+#define LINE_INDEX_STEP (512)
+
+static struct {
+	const line_desc *ld;
+	line_checkpoint *cp;
+	int64_t n, size;
+	int tab_size;
+	bool utf8, complete;
+} line_index[LINE_INDEX_SIZE];
+
+static inline int line_index_hash(const line_desc * const ld) {
+	return ((uintptr_t)ld / sizeof(no_syntax_line_desc)) % LINE_INDEX_SIZE;
+}
+
+/* Returns the last checkpoint of the given line descriptor whose width (if
+   by_width is true) or position (otherwise) is smaller than or equal to
+   key. Short lines (and out-of-memory conditions) yield the start of the
+   line. A zero tab_size matches any tab size (useful when widths are not
+   needed). */
+
+static line_checkpoint line_checkpoint_find(const line_desc * const ld, const int64_t key, const bool by_width, const int tab_size, const encoding_type encoding) {
+	static const line_checkpoint start;
+	if (ld->line_len < LINE_INDEX_THRESHOLD || key <= 0) return start;
+
+	/* ASCII and 8-bit lines are scanned in the same way. */
+	const bool utf8 = encoding == ENC_UTF8;
+	const int h = line_index_hash(ld);
+
+	if (line_index[h].ld != ld || tab_size && line_index[h].tab_size != tab_size || line_index[h].utf8 != utf8) {
+		if (line_index[h].size == 0) {
+			if (!(line_index[h].cp = malloc(64 * sizeof *line_index[h].cp))) return start;
+			line_index[h].size = 64;
+		}
+		line_index[h].ld = ld;
+		line_index[h].tab_size = tab_size ? tab_size : 8;
+		line_index[h].utf8 = utf8;
+		line_index[h].cp[0] = start;
+		line_index[h].n = 1;
+		line_index[h].complete = false;
+	}
+
+	assert(line_index[h].cp[line_index[h].n - 1].pos <= ld->line_len);
+
+	/* We extend the index until its last checkpoint is beyond key, or we
+		reach the end of the line. */
+	while(!line_index[h].complete) {
+		const line_checkpoint * const last = &line_index[h].cp[line_index[h].n - 1];
+		if ((by_width ? last->width : last->pos) > key) break;
+
+		int64_t pos = last->pos, chars = last->chars, width = last->width;
+		for(int i = 0; i < LINE_INDEX_STEP && pos < ld->line_len; i++, chars++) {
+			if (ld->line[pos] != '\t') width += get_char_width(&ld->line[pos], encoding);
+			else width += line_index[h].tab_size - width % line_index[h].tab_size;
+			pos = next_pos(ld->line, pos, encoding);
+		}
+
+		if (pos == ld->line_len) line_index[h].complete = true;
+		else {
+			if (line_index[h].n == line_index[h].size) {
+				line_checkpoint * const p = realloc(line_index[h].cp, line_index[h].size * 2 * sizeof *p);
+				if (!p) break;
+				line_index[h].cp = p;
+				line_index[h].size *= 2;
+			}
+			line_index[h].cp[line_index[h].n++] = (line_checkpoint){ pos, chars, width };
+		}
+	}
+
+	/* Positions and widths are strictly increasing, so we can use binary search. */
+	const line_checkpoint * const cp = line_index[h].cp;
+	int64_t l = 0, r = line_index[h].n - 1;
+	while(l < r) {
+		const int64_t m = (l + r + 1) / 2;
+		if ((by_width ? cp[m].width : cp[m].pos) <= key) l = m;
+		else r = m - 1;
+	}
+
+	return cp[l];
+}
+
+/* Returns the last checkpoint of the given line descriptor whose position is
+   smaller than or equal to pos. */
+
+line_checkpoint line_checkpoint_at_pos(const line_desc * const ld, const int64_t pos, const int tab_size, const encoding_type encoding) {
+	return line_checkpoint_find(ld, pos, false, tab_size, encoding);
+}
+
+/* Returns the last checkpoint of the given line descriptor whose width is
+   smaller than or equal to col. */
+
+line_checkpoint line_checkpoint_at_col(const line_desc * const ld, const int64_t col, const int tab_size, const encoding_type encoding) {
+	return line_checkpoint_find(ld, col, true, tab_size, encoding);
+}
+
+/* Discards the checkpoints of the given line descriptor beyond pos. It must be
+   called after modifying the line at pos, and with pos equal to 0 when the
+   line descriptor is allocated or freed. */
+
+void line_index_invalidate(const line_desc * const ld, const int64_t pos) {
+	const int h = line_index_hash(ld);
+	if (line_index[h].ld != ld) return;
+	while(line_index[h].n > 1 && line_index[h].cp[line_index[h].n - 1].pos > pos) line_index[h].n--;
+	line_index[h].complete = false;
+}
+
+/* Empties the line index. */
+
+void line_index_flush(void) {
+	for(int i = 0; i < LINE_INDEX_SIZE; i++) line_index[i].ld = NULL;
+}
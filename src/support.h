@@ -19,6 +19,17 @@
    along with this program; if not, see <http://www.gnu.org/licenses/>.  */
 
 
+/* Most of the functions below take an encoding argument and test it on every
+   character. When they are inlined into a function whose encoding argument is
+   a compile-time constant, the tests are folded away. SPECIALIZE_ENCODING()
+   tests encoding just once, and calls f with the given arguments followed by
+   the corresponding constant: f is thus compiled into three specialized
+   variants (US-ASCII, 8-bit and UTF-8), and the choice happens once per call. f
+   must be a static inline function, and may return void. */
+
+#define SPECIALIZE_ENCODING(encoding, f, ...) \
+	((encoding) == ENC_UTF8 ? f(__VA_ARGS__, ENC_UTF8) : (encoding) == ENC_ASCII ? f(__VA_ARGS__, ENC_ASCII) : f(__VA_ARGS__, ENC_8_BIT))
+
 /* Returns the position of the character after the one pointed by pos in s. If
    s is NULL, just returns pos + 1. If encoding is UTF8 it uses utf8len() to
    move forward. */
@@ -47,29 +58,58 @@ static int64_t inline prev_pos(const char * const s, int64_t pos, const encoding
 }
 
 /* Returns the width of the ISO 10646 character represented by the sequence of bytes
-   starting at s, using the provided encoding. */
+   starting at s, using the provided encoding. In US-ASCII and 8-bit text all
+   characters have width one (output_width() is 1 on all values below 256), so
+   the functions below use byte arithmetic for those encodings. */
 
 static int inline get_char_width(const char * const s, const encoding_type encoding) {
 	assert(s != NULL);
-	return *(unsigned char *)s < 128 ? 1 : encoding == ENC_UTF8 ? output_width(utf8char(s)) : output_width(*(unsigned char *)s);
+	assert(encoding == ENC_UTF8 || output_width(*(unsigned char *)s) == 1);
+	return encoding != ENC_UTF8 || *(unsigned char *)s < 128 ? 1 : output_width(utf8char(s));
 }
 
-/* Computes the TAB-expanded width of a line descriptor up to a certain
-   position. The position can be greater than the line length, the usual
-   convention of infinite expansion via spaces being in place. */
-
-static int64_t inline calc_width(const line_desc * const ld, const int64_t n, const int tab_size, const encoding_type encoding) {
+/* Returns width plus the TAB-expanded width of ld->line from pos (which has
+   column width) up to n, with the same conventions of calc_width(). */
+
+static int64_t inline scan_width(const line_desc * const ld, int64_t pos, const int64_t n, int64_t width, const int tab_size, const encoding_type encoding) {
+	if (encoding != ENC_UTF8) {
+		/* We jump from TAB to TAB. */
+		const int64_t end = min(n, ld->line_len);
+		while(pos < end) {
+			const char * const t = memchr(ld->line + pos, '\t', end - pos);
+			if (t == NULL) {
+				width += end - pos;
+				pos = end;
+				break;
+			}
+			width += t - ld->line - pos;
+			width += tab_size - width % tab_size;
+			pos = t - ld->line + 1;
+		}
+		return pos < n ? width + n - pos : width;
+	}
 
-	int64_t width = 0;
-	for(int64_t pos = 0; pos < n; pos = pos < ld->line_len ? next_pos(ld->line, pos, encoding) : pos + 1) {
+	for(; pos < n; pos = pos < ld->line_len ? next_pos(ld->line, pos, ENC_UTF8) : pos + 1) {
 		if (pos >= ld->line_len) width++;
-		else if (ld->line[pos] != '\t') width += get_char_width(&ld->line[pos], encoding);
+		else if (ld->line[pos] != '\t') width += get_char_width(&ld->line[pos], ENC_UTF8);
 		else width += tab_size - width % tab_size;
 	}
-
 	return width;
 }
 
+/* Computes the TAB-expanded width of a line descriptor up to a certain
+   position. The position can be greater than the line length, the usual
+   convention of infinite expansion via spaces being in place. Long lines
+   are scanned starting from the nearest checkpoint of the line index. */
+
+static int64_t inline calc_width(const line_desc * const ld, const int64_t n, const int tab_size, const encoding_type encoding) {
+	if (ld->line_len >= LINE_INDEX_THRESHOLD) {
+		const line_checkpoint cp = line_checkpoint_at_pos(ld, min(n, ld->line_len), tab_size, encoding);
+		return scan_width(ld, cp.pos, n, cp.width, tab_size, encoding);
+	}
+	return scan_width(ld, 0, n, 0, tab_size, encoding);
+}
+
 /* Computes the TAB-expanded width of a line descriptor up to a certain
    position. The position can be greater than the line length, the usual
    convention of infinite expansion via spaces being in place. An initial
@@ -77,15 +117,7 @@ static int64_t inline calc_width(const line_desc * const ld, const int64_t n, co
    known width. */
 
 static int64_t inline calc_width_hint(const line_desc * const ld, const int64_t n, const int tab_size, const encoding_type encoding, const int64_t cur_pos, const int64_t cur_width) {
-	if (cur_pos < n) {
-		int64_t width = cur_width;
-		for(int64_t pos = cur_pos; pos < n; pos = pos < ld->line_len ? next_pos(ld->line, pos, encoding) : pos + 1) {
-			if (pos >= ld->line_len) width++;
-			else if (ld->line[pos] != '\t') width += get_char_width(&ld->line[pos], encoding);
-			else width += tab_size - width % tab_size;
-		}
-		return width;
-	}
+	if (cur_pos < n) return scan_width(ld, cur_pos, n, cur_width, tab_size, encoding);
 	else return calc_width(ld, n, tab_size, encoding);
 }
 
@@ -93,26 +125,67 @@ static int64_t inline calc_width_hint(const line_desc * const ld, const int64_t
 /* Computes character length of a line descriptor up to a given position. */
 
 static int64_t inline calc_char_len(const line_desc * const ld, const int64_t n, const encoding_type encoding) {
-	int64_t len = 0;
-	for(int64_t pos = 0; pos < n; pos = next_pos(ld->line, pos, encoding), len++);
+	int64_t pos = 0, len = 0;
+	if (ld->line_len >= LINE_INDEX_THRESHOLD) {
+		/* We do not need widths, so any tab size will do. */
+		const line_checkpoint cp = line_checkpoint_at_pos(ld, min(n, ld->line_len), 0, encoding);
+		pos = cp.pos;
+		len = cp.chars;
+	}
+	if (encoding != ENC_UTF8) return pos < n ? len + n - pos : len;
+	for(; pos < n; pos = next_pos(ld->line, pos, ENC_UTF8), len++);
 	return len;
 }
 
 
+/* Returns the index of the byte of ld->line "containing" column col (see
+   calc_pos()), scanning from pos, which has column *width, and stores in
+   *width the column of the returned index. */
+
+static int64_t inline scan_pos(const line_desc * const ld, int64_t pos, const int64_t col, int64_t * const width, const int tab_size, const encoding_type encoding) {
+	int64_t w = *width;
+	if (encoding != ENC_UTF8) {
+		/* We jump from TAB to TAB. */
+		while(pos < ld->line_len && w < col) {
+			const char * const t = memchr(ld->line + pos, '\t', ld->line_len - pos);
+			const int64_t next = t ? t - ld->line : ld->line_len;
+			if (next - pos >= col - w) {
+				pos += col - w;
+				w = col;
+				break;
+			}
+			w += next - pos;
+			pos = next;
+			if (t != NULL) {
+				w += tab_size - w % tab_size;
+				pos++;
+			}
+		}
+	}
+	else {
+		int c_width;
+		for(; pos < ld->line_len && w + (c_width = get_char_width(&ld->line[pos], ENC_UTF8)) <= col; pos = next_pos(ld->line, pos, ENC_UTF8)) {
+			if (ld->line[pos] != '\t') w += c_width;
+			else w += tab_size - w % tab_size;
+		}
+	}
+	*width = w;
+	return pos;
+}
+
 /* Given a column, the index of the byte "containing" that position is
    given, that is, calc_width(index) > n, and index is minimum with this
    property. If the width of the line is smaller than the given column, the
    line length is returned. */
 
 static int64_t inline calc_pos(const line_desc * const ld, const int64_t col, const int tab_size, const encoding_type encoding) {
-	int c_width;
-	int64_t pos = 0;
-	for(int64_t width = 0; pos < ld->line_len && width + (c_width = get_char_width(&ld->line[pos], encoding)) <= col; pos = next_pos(ld->line, pos, encoding)) {
-		if (ld->line[pos] != '\t') width += c_width;
-		else width += tab_size - width % tab_size;
+	int64_t pos = 0, width = 0;
+	if (ld->line_len >= LINE_INDEX_THRESHOLD) {
+		const line_checkpoint cp = line_checkpoint_at_col(ld, col, tab_size, encoding);
+		pos = cp.pos;
+		width = cp.width;
 	}
-
-	return pos;
+	return scan_pos(ld, pos, col, &width, tab_size, encoding);
 }
 
 /* Given a column, the index of the byte "containing" that position is
@@ -121,12 +194,13 @@ static int64_t inline calc_pos(const line_desc * const ld, const int64_t col, co
    line is extended with spaces. */
 
 static int64_t inline calc_virt_pos(const line_desc * const ld, const int64_t col, const int tab_size, const encoding_type encoding) {
-	int c_width;
-	int64_t pos, width;
-	for(pos = width = 0; pos < ld->line_len && width + (c_width = get_char_width(&ld->line[pos], encoding)) <= col; pos = next_pos(ld->line, pos, encoding)) {
-		if (ld->line[pos] != '\t') width += c_width;
-		else width += tab_size - width % tab_size;
+	int64_t pos = 0, width = 0;
+	if (ld->line_len >= LINE_INDEX_THRESHOLD) {
+		const line_checkpoint cp = line_checkpoint_at_col(ld, col, tab_size, encoding);
+		pos = cp.pos;
+		width = cp.width;
 	}
+	pos = scan_pos(ld, pos, col, &width, tab_size, encoding);
 
 	assert(pos <= ld->line_len);
 	assert(pos == ld->line_len || width == col);
@@ -192,7 +266,7 @@ static int inline get_char(const char * const s, const encoding_type encoding) {
    encoding. If s is NULL, returns len. */
 
 static int inline get_string_width(const char * const s, const int64_t len, const encoding_type encoding) {
-	if (s == NULL) return len;
+	if (s == NULL || encoding != ENC_UTF8) return len;
 	int64_t width = 0;
 	for(int64_t pos = 0; pos < len; pos = next_pos(s, pos, encoding)) width += get_char_width(s + pos, encoding);
 	return width;
@@ -141,3 +141,15 @@ void *htfind(HASH *ht, unsigned char *name)
 	}
 	return NULL;
 }
+
+/* Call f on each entry of a hash table, passing along arg */
+
+void htall(HASH *ht, void (*f)(unsigned char *name, void *val, void *arg), void *arg)
+{
+	unsigned x;
+	HENTRY *e;
+
+	for (x = 0; x != ht->len; ++x)
+		for (e = ht->tab[x]; e; e = e->next)
+			f(e->name, e->val, arg);
+}
@@ -51,4 +51,7 @@ void *htadd PARAMS((HASH *ht, unsigned char *name, void *val));
 /* Look up an entry in a hash table, returns NULL if not found */
 void *htfind PARAMS((HASH *ht, unsigned char *name));
 
+/* Call f on each entry of a hash table, passing along arg */
+void htall PARAMS((HASH *ht, void (*f)(unsigned char *name, void *val, void *arg), void *arg));
+
 #endif
@@ -22,6 +22,7 @@
 #include <string.h>
 #include <errno.h>
 #include <math.h>
+#include <stdint.h>
 
 #define joe_gettext(s) my_gettext((unsigned char *)(s))
 
@@ -104,4 +105,20 @@ struct highlight_state {
 	unsigned char saved_s[24];  /* Buffer for saved delimiters */
 };
 
+/* The attributes of the characters of a line, stored as runs of characters
+   with the same attributes, so that their size depends on the number of
+   color changes rather than on the length of the line. */
+
+typedef struct {
+	int64_t len;			/* No. characters */
+	uint32_t attr;			/* Their attributes */
+} attr_span;
+
+typedef struct {
+	attr_span *span;		/* The runs, in order */
+	int64_t nspans;			/* No. runs */
+	int64_t size;			/* Allocated runs */
+	int64_t len;			/* No. characters */
+} attr_spans;
+
 
@@ -0,0 +1,356 @@
+/* Headless syntax highlighting benchmark.
+
+   Copyright (C) 2009-2017 Todd M. Lewis and Sebastiano Vigna
+
+   This file is part of ne, the nice editor.
+
+   This library is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or (at your
+   option) any later version.
+
+   This library is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+   or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+   for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.  */
+
+
+#include "ne.h"
+#include <dirent.h>
+#include <time.h>
+
+/* This program loads syntax definitions and runs parse() over a corpus,
+   line by line and carrying the state from each line to the next one,
+   exactly as ne does when highlighting a document. It is linked only with
+   the syntax highlighting modules, and it needs no terminal.
+
+   Usage: synbench [-u] [-s size] [-t seconds] dir [syntax[=file]...]
+
+   dir is a directory containing a syntax subdirectory (e.g., ".." in the
+   source tree); with no syntax arguments, all definitions in it are used.
+   Each syntax parses the given file, or a corpus of size bytes (default 1M)
+   generated from its own keywords together with identifiers, numbers,
+   strings, comments, tags and punctuation. The generator is deterministic, so
+   runs of different builds are comparable. Passes over the corpus are
+   repeated for at least the given number of seconds (default 0.2); -u
+   parses in UTF-8 mode.
+
+   The output is a tab-separated table, with a header line starting with
+   '#', a line per syntax and a final total: bytes and lines of the corpus,
+   passes, seconds, MB/s, lines/s, reallocations of attr_buf in the first
+   pass, and milliseconds taken to load the definition. */
+
+static const char *syntax_dir;
+
+/* The syntax modules look up definitions in the global and user preferences
+   directories: we provide just the global one, so that local definitions
+   and the syntax cache are ignored. */
+
+char *exists_prefs_dir(void) {
+	return NULL;
+}
+
+char *exists_gprefs_dir(void) {
+	return (char *)syntax_dir;
+}
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1E9;
+}
+
+/* A xorshift generator, seeded by the syntax name. */
+
+static uint64_t seed;
+
+static unsigned rnd(const unsigned n) {
+	seed ^= seed << 13;
+	seed ^= seed >> 7;
+	seed ^= seed << 17;
+	return seed % n;
+}
+
+/* A growable string. */
+
+typedef struct {
+	char *s;
+	int64_t len, size;
+} text;
+
+static void append(text * const t, const char * const s, const int64_t len) {
+	if (t->len + len > t->size) {
+		t->size = (t->len + len) * 2;
+		if (!(t->s = realloc(t->s, t->size))) {
+			fprintf(stderr, "synbench: out of memory\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	memcpy(t->s + t->len, s, len);
+	t->len += len;
+}
+
+static void appends(text * const t, const char * const s) {
+	append(t, s, strlen(s));
+}
+
+/* Collects the keywords of all commands of syntax. */
+
+static void collect_keywords(struct high_syntax * const syntax, text * const kw, int * const nkw) {
+	for(int s = 0; s < syntax->nstates; s++)
+		for(int c = 0; c < syntax->nclasses; c++) {
+			const struct high_keywords * const k = syntax->states[s]->row[c]->keywords;
+			if (!k) continue;
+			for(unsigned i = 0; i <= k->mask; i++)
+				if (k->slot[i].name && k->slot[i].len) {
+					append(kw, (const char *)k->slot[i].name, k->slot[i].len + 1);
+					(*nkw)++;
+				}
+		}
+}
+
+static const char * const punct[] = { "(", ")", "{", "}", "[", "]", ";", ",", ".", "=", "==", "+", "-", "*", "/", "<", ">", "&&", "||", ":", "->", "!", "$", "@" };
+static const char * const comment[][2] = { { "/* ", " */" }, { "// ", "" }, { "# ", "" }, { "-- ", "" }, { "; ", "" }, { "<!-- ", " -->" }, { "(* ", " *)" } };
+
+#define ELEMS(a) (sizeof (a) / sizeof *(a))
+
+static void word(text * const t) {
+	const int len = 1 + rnd(10);
+	for(int i = 0; i < len; i++) append(t, &"abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ_0123456789"[rnd(i ? 63 : 53)], 1);
+}
+
+/* Generates a corpus of about size bytes for syntax. */
+
+static void generate(struct high_syntax * const syntax, const int64_t size, text * const t) {
+	text kw = { 0 };
+	const char **kws = NULL;
+	int nkw = 0;
+
+	collect_keywords(syntax, &kw, &nkw);
+	if (nkw) {
+		kws = malloc(sizeof *kws * nkw);
+		for(int i = 0, j = 0; i < nkw; i++) {
+			kws[i] = kw.s + j;
+			j += strlen(kws[i]) + 1;
+		}
+	}
+
+	seed = 0x9E3779B97F4A7C15ULL;
+	for(const unsigned char *p = syntax->name; *p; p++) seed = (seed ^ *p) * 0x100000001B3ULL;
+	if (!seed) seed = 1;
+
+	while(t->len < size) {
+		const int64_t start = t->len;
+		const int width = rnd(90);
+		const int r = rnd(100);
+
+		for(int i = rnd(4); i-- != 0;) appends(t, rnd(2) ? "\t" : "    ");
+		if (r < 5) {
+			const int c = rnd(ELEMS(comment));
+			appends(t, comment[c][0]);
+			while(t->len - start < width) { word(t); appends(t, " "); }
+			appends(t, comment[c][1]);
+		}
+		else if (r > 7) {
+			while(t->len - start < width) {
+				const int k = rnd(100);
+				if (k < 40 && nkw) appends(t, kws[rnd(nkw)]);
+				else if (k < 65) word(t);
+				else if (k < 75) {
+					char n[16];
+					sprintf(n, "%u", rnd(100000));
+					appends(t, n);
+				}
+				else if (k < 85) {
+					const char * const q = rnd(2) ? "\"" : "'";
+					appends(t, q);
+					for(int i = rnd(5); i-- != 0;) { word(t); if (i) appends(t, " "); }
+					if (!rnd(8)) appends(t, "\\n");
+					appends(t, q);
+				}
+				else if (k < 90) {
+					appends(t, rnd(2) ? "<" : "</");
+					word(t);
+					if (rnd(2)) { appends(t, " "); word(t); appends(t, "=\""); word(t); appends(t, "\""); }
+					appends(t, ">");
+				}
+				else appends(t, punct[rnd(ELEMS(punct))]);
+				appends(t, rnd(4) ? " " : "");
+			}
+			if (!rnd(20)) {
+				const int c = rnd(ELEMS(comment));
+				appends(t, " ");
+				appends(t, comment[c][0]);
+				word(t);
+				appends(t, comment[c][1]);
+			}
+		}
+		appends(t, "\n");
+	}
+
+	free(kws);
+	free(kw.s);
+}
+
+static int load_file(const char * const name, text * const t) {
+	FILE * const f = fopen(name, "rb");
+	char b[65536];
+	size_t n;
+
+	if (!f) return 0;
+	while((n = fread(b, 1, sizeof b, f))) append(t, b, n);
+	fclose(f);
+	return 1;
+}
+
+/* Splits t into lines (dropping the newlines); returns the number of lines. */
+
+static int64_t split(text * const t, line_desc ** const ld) {
+	int64_t n = 0;
+	for(int64_t i = 0; i < t->len; i++) if (t->s[i] == '\n') n++;
+	if (t->len && t->s[t->len - 1] != '\n') n++;
+
+	*ld = calloc(n ? n : 1, sizeof **ld);
+	for(int64_t i = 0, j = 0, start = 0; i <= t->len && j < n; i++)
+		if (i == t->len || t->s[i] == '\n') {
+			(*ld)[j].line = t->s + start;
+			(*ld)[j++].line_len = i - start;
+			start = i + 1;
+		}
+	return n;
+}
+
+/* Parses all lines once; returns the number of reallocations of attr_buf. */
+
+static int pass(struct high_syntax * const syntax, line_desc * const ld, const int64_t n, const bool utf8) {
+	HIGHLIGHT_STATE state;
+	const attr_span *buf = attr_buf.span;
+	int allocs = 0;
+
+	clear_state(&state);
+	for(int64_t i = 0; i < n; i++) {
+		state = parse(syntax, ld + i, state, utf8);
+		if (attr_buf.span != buf) {
+			buf = attr_buf.span;
+			allocs++;
+		}
+	}
+	return allocs;
+}
+
+static int bench(const char * const name, const char * const file, const int64_t size, const double min_time, const bool utf8, double * const tot_bytes, double * const tot_lines, double * const tot_time) {
+	text t = { 0 };
+	line_desc *ld;
+
+	const double load_start = now();
+	struct high_syntax * const syntax = load_syntax((unsigned char *)name);
+	const double load_time = now() - load_start;
+	if (!syntax) {
+		fprintf(stderr, "synbench: cannot load syntax %s\n", name);
+		return 0;
+	}
+
+	if (file) {
+		if (!load_file(file, &t)) {
+			fprintf(stderr, "synbench: cannot read %s\n", file);
+			return 0;
+		}
+	}
+	else generate(syntax, size, &t);
+
+	const int64_t nlines = split(&t, &ld);
+
+	/* Start from an empty attribute buffer, so that allocations are comparable. */
+	free(attr_buf.span);
+	attr_buf = (attr_spans){ 0 };
+
+	int passes = 0, allocs = 0;
+	const double start = now();
+	double elapsed;
+	do {
+		const int a = pass(syntax, ld, nlines, utf8);
+		if (passes++ == 0) allocs = a;
+	} while((elapsed = now() - start) < min_time);
+
+	printf("%s\t%" PRId64 "\t%" PRId64 "\t%d\t%.4f\t%.2f\t%.0f\t%d\t%.2f\n", name, t.len, nlines, passes, elapsed,
+		t.len * (double)passes / elapsed / 1E6, nlines * (double)passes / elapsed, allocs, load_time * 1E3);
+
+	*tot_bytes += t.len * (double)passes;
+	*tot_lines += nlines * (double)passes;
+	*tot_time += elapsed;
+	free(ld);
+	free(t.s);
+	return 1;
+}
+
+static int cmp(const void *a, const void *b) {
+	return strcmp(*(const char **)a, *(const char **)b);
+}
+
+int main(int argc, char **argv) {
+	int64_t size = 1 << 20;
+	double min_time = .2;
+	bool utf8 = false;
+	int c;
+
+	while((c = getopt(argc, argv, "us:t:")) != -1) {
+		switch(c) {
+			case 'u': utf8 = true; break;
+			case 's': size = strtoll(optarg, NULL, 0); break;
+			case 't': min_time = strtod(optarg, NULL); break;
+			default:
+				fprintf(stderr, "Usage: synbench [-u] [-s size] [-t seconds] dir [syntax[=file]...]\n");
+				return EXIT_FAILURE;
+		}
+	}
+	if (optind >= argc) {
+		fprintf(stderr, "Usage: synbench [-u] [-s size] [-t seconds] dir [syntax[=file]...]\n");
+		return EXIT_FAILURE;
+	}
+
+	/* The directory name must end with a '/'. */
+	char * const dir = malloc(strlen(argv[optind]) + 2);
+	strcat(strcpy(dir, argv[optind]), "/");
+	syntax_dir = dir;
+
+	char **names = argv + optind + 1;
+	int n = argc - optind - 1;
+	if (n == 0) {
+		/* All definitions in the syntax directory. */
+		char * const syn_dir_name = malloc(strlen(dir) + strlen(SYNTAX_DIR) + 1);
+		strcat(strcpy(syn_dir_name, dir), SYNTAX_DIR);
+		DIR * const d = opendir(syn_dir_name);
+		if (!d) {
+			fprintf(stderr, "synbench: cannot open %s\n", syn_dir_name);
+			return EXIT_FAILURE;
+		}
+		struct dirent *de;
+		names = NULL;
+		while((de = readdir(d))) {
+			const size_t len = strlen(de->d_name);
+			if (len > strlen(SYNTAX_EXT) && !strcmp(de->d_name + len - strlen(SYNTAX_EXT), SYNTAX_EXT)) {
+				names = realloc(names, sizeof *names * (n + 1));
+				names[n] = strdup(de->d_name);
+				names[n++][len - strlen(SYNTAX_EXT)] = 0;
+			}
+		}
+		closedir(d);
+		qsort(names, n, sizeof *names, cmp);
+	}
+
+	double tot_bytes = 0, tot_lines = 0, tot_time = 0;
+	int failed = 0;
+
+	printf("#syntax\tbytes\tlines\tpasses\tseconds\tMB/s\tlines/s\tallocs\tload_ms\n");
+	for(int i = 0; i < n; i++) {
+		char * const eq = strchr(names[i], '=');
+		if (eq) *eq = 0;
+		if (!bench(names[i], eq ? eq + 1 : NULL, size, min_time, utf8, &tot_bytes, &tot_lines, &tot_time)) failed++;
+	}
+	if (tot_time > 0) printf("total\t%.0f\t%.0f\t-\t%.4f\t%.2f\t%.0f\t-\t-\n", tot_bytes, tot_lines, tot_time, tot_bytes / tot_time / 1E6, tot_lines / tot_time);
+
+	return failed == n ? EXIT_FAILURE : EXIT_SUCCESS;
+}
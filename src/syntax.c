@@ -165,15 +165,332 @@ unsigned char *lowerize(unsigned char *s) {
 	return s;
 }
 
+/* Lower-case version of each byte, used to match case-insensitive
+   keywords and delimiters in place. */
+
+static unsigned char fold[256];
+
+static void init_fold(void)
+{
+	int c;
+	for(c=0;c!=256;++c)
+		fold[c] = tolower(c);
+}
+
+#define kw_hash(h, c) ((h) * 31 + (c))
+
+/* Return the command for the keyword s in kw, or NULL if s is not a keyword.
+   If ignore is set, s is matched ignoring case. */
+
+static inline struct high_cmd *find_keyword(const struct high_keywords * const kw, const unsigned char * const s, const bool ignore)
+{
+	const unsigned char * const f = ignore ? fold : NULL;
+	unsigned h = 0;
+	int len, i;
+
+	if (f)
+		for(len=0;s[len];++len)
+			h = kw_hash(h, f[s[len]]);
+	else
+		for(len=0;s[len];++len)
+			h = kw_hash(h, s[len]);
+
+	for(i=h&kw->mask;kw->slot[i].name;i=(i+1)&kw->mask) {
+		const struct high_keyword * const k = kw->slot + i;
+		if (k->hash == h && k->len == len) {
+			if (!f) {
+				if (!memcmp(k->name, s, len))
+					return k->cmd;
+			} else {
+				int j;
+				for(j=0;j!=len && k->name[j]==f[s[j]];++j);
+				if (j == len)
+					return k->cmd;
+			}
+		}
+	}
+	return NULL;
+}
+
+/* Return the first byte in [p..q) that may leave a state, or q. The byte
+   delim (if nonnegative) may leave the state, too, and in UTF-8 mode so
+   may every non-ASCII byte, as characters are decoded by the slow path.
+   When the other bytes are few we check eight bytes at a time, using the
+   classic test for a zero byte in a word. */
+
+#define ONES 0x0101010101010101ULL
+#define HIGHS 0x8080808080808080ULL
+#define has_zero(x) (((x) - ONES) & ~(x) & HIGHS)
+
+static inline const unsigned char *skip_run(const struct high_skip * const skip, const unsigned char *p, const unsigned char * const q, const int delim, const bool utf8)
+{
+	const unsigned hi = utf8 ? 0x80 : 0x100;
+
+	if (skip->nwords >= 0) {
+		const uint64_t high = utf8 || skip->high ? HIGHS : 0, d = delim >= 0 ? delim * ONES : 0;
+		const int nwords = skip->nwords;
+		int i;
+		while(q - p >= 8) {
+			uint64_t w, m;
+			memcpy(&w, p, sizeof w);
+			m = w & high;
+			for(i=0;i!=nwords;++i)
+				m |= has_zero(w ^ skip->word[i]);
+			if (delim >= 0)
+				m |= has_zero(w ^ d);
+			if (m)
+				break;
+			p += 8;
+		}
+	}
+
+	for(;p<q;++p)
+		if (skip->stop[*p >> 5] >> (*p & 31) & 1 || *p >= hi || *p == delim)
+			break;
+	return p;
+}
+
+/* Compare a and b ignoring case; returns 0 if they are equal. */
+
+static inline int fold_cmp(const unsigned char *a, const unsigned char *b)
+{
+	while(*a && fold[*a] == fold[*b])
+		++a, ++b;
+	return fold[*a] - fold[*b];
+}
+
+/* Attribute runs. Positions and lengths are measured in characters. */
+
+/* Makes room for n more runs in a. */
+
+static void attr_grow(attr_spans * const a, const int64_t n)
+{
+	if (a->nspans + n > a->size) {
+		a->size = a->size * 2 > a->nspans + n ? a->size * 2 : a->nspans + n + 16;
+		a->span = joe_realloc(a->span, sizeof(attr_span) * a->size);
+	}
+}
+
+/* Returns the index of the run starting at pos, splitting the run containing
+   pos if necessary (a->nspans if pos is the length of a). We scan from the
+   nearest end, as most changes happen at the end of a line or near the
+   cursor. */
+
+static int64_t attr_split(attr_spans * const a, const int64_t pos)
+{
+	int64_t i, start;
+
+	assert(pos >= 0 && pos <= a->len);
+	if (pos == a->len)
+		return a->nspans;
+	if (pos >= a->len / 2)
+		for(i=a->nspans,start=a->len;start>pos;)
+			start -= a->span[--i].len;
+	else
+		for(i=0,start=0;start+a->span[i].len<=pos;)
+			start += a->span[i++].len;
+
+	if (start < pos) {
+		attr_grow(a, 1);
+		memmove(a->span + i + 1, a->span + i, (a->nspans++ - i) * sizeof(attr_span));
+		a->span[i].len = pos - start;
+		a->span[++i].len -= pos - start;
+	}
+	return i;
+}
+
+/* Merges run i with the previous one, if they have the same attributes. */
+
+static void attr_merge(attr_spans * const a, const int64_t i)
+{
+	if (i > 0 && i < a->nspans && a->span[i - 1].attr == a->span[i].attr) {
+		a->span[i - 1].len += a->span[i].len;
+		memmove(a->span + i, a->span + i + 1, (--a->nspans - i) * sizeof(attr_span));
+	}
+}
+
+/* Appends len characters with attributes attr. */
+
+void attr_append(attr_spans * const a, const int64_t len, const uint32_t attr)
+{
+	if (len <= 0)
+		return;
+	if (a->nspans && a->span[a->nspans - 1].attr == attr)
+		a->span[a->nspans - 1].len += len;
+	else {
+		attr_grow(a, 1);
+		a->span[a->nspans].len = len;
+		a->span[a->nspans++].attr = attr;
+	}
+	a->len += len;
+}
+
+/* Sets to attr the attributes of len characters starting at pos, extending a
+   if necessary. */
+
+void attr_fill(attr_spans * const a, const int64_t pos, const int64_t len, const uint32_t attr)
+{
+	int64_t i, j;
+
+	if (len <= 0)
+		return;
+	if (pos + len > a->len) {
+		attr_fill(a, pos, a->len - pos, attr);
+		attr_append(a, pos + len - a->len, attr);
+		return;
+	}
+
+	i = attr_split(a, pos);
+	j = attr_split(a, pos + len);
+	a->span[i].len = len;
+	a->span[i].attr = attr;
+	memmove(a->span + i + 1, a->span + j, (a->nspans - j) * sizeof(attr_span));
+	a->nspans -= j - i - 1;
+	attr_merge(a, i + 1);
+	attr_merge(a, i);
+}
+
+/* Inserts len characters with attributes attr at pos. */
+
+void attr_insert(attr_spans * const a, const int64_t pos, const int64_t len, const uint32_t attr)
+{
+	int64_t i;
+
+	if (len <= 0)
+		return;
+	i = attr_split(a, pos);
+	attr_grow(a, 1);
+	memmove(a->span + i + 1, a->span + i, (a->nspans++ - i) * sizeof(attr_span));
+	a->span[i].len = len;
+	a->span[i].attr = attr;
+	a->len += len;
+	attr_merge(a, i + 1);
+	attr_merge(a, i);
+}
+
+/* Deletes len characters starting at pos. */
+
+void attr_delete(attr_spans * const a, const int64_t pos, int64_t len)
+{
+	int64_t i, j;
+
+	if (pos + len > a->len)
+		len = a->len - pos;
+	if (len <= 0)
+		return;
+	i = attr_split(a, pos);
+	j = attr_split(a, pos + len);
+	memmove(a->span + i, a->span + j, (a->nspans - j) * sizeof(attr_span));
+	a->nspans -= j - i;
+	a->len -= len;
+	attr_merge(a, i);
+}
+
+/* Truncates a to len characters. */
+
+void attr_truncate(attr_spans * const a, const int64_t len)
+{
+	if (len < a->len) {
+		a->nspans = attr_split(a, len);
+		a->len = len;
+	}
+}
+
+void attr_copy(attr_spans * const dst, const attr_spans * const src)
+{
+	dst->nspans = 0;
+	attr_grow(dst, src->nspans);
+	memcpy(dst->span, src->span, src->nspans * sizeof(attr_span));
+	dst->nspans = src->nspans;
+	dst->len = src->len;
+}
+
+/* Returns the attributes of the character at pos (0 if pos is beyond the
+   end), and stores in *end (if not NULL) the end of its run. As in
+   attr_split(), we scan from the nearest end. To scan several positions,
+   use a cursor instead (see display.c). */
+
+uint32_t attr_at(const attr_spans * const a, const int64_t pos, int64_t * const end)
+{
+	int64_t i, start;
+
+	assert(pos >= 0);
+	if (pos >= a->len) {
+		if (end)
+			*end = INT64_MAX;
+		return 0;
+	}
+	if (pos >= a->len / 2)
+		for(i=a->nspans,start=a->len;start>pos;)
+			start -= a->span[--i].len;
+	else
+		for(i=0,start=0;start+a->span[i].len<=pos;)
+			start += a->span[i++].len;
+
+	if (end)
+		*end = start + a->span[i].len;
+	return a->span[i].attr;
+}
+
+/* Returns whether the first len characters of a and b have the same attributes. */
+
+bool attr_equal(const attr_spans * const a, const attr_spans * const b, const int64_t len)
+{
+	int64_t i = 0, j = 0, left_a, left_b, pos = 0;
+
+	if (a->len < len || b->len < len)
+		return false;
+	left_a = a->nspans ? a->span[0].len : 0;
+	left_b = b->nspans ? b->span[0].len : 0;
+	while(pos < len) {
+		const int64_t n = left_a < left_b ? left_a : left_b;
+		if (a->span[i].attr != b->span[j].attr)
+			return false;
+		pos += n;
+		if (!(left_a -= n) && ++i < a->nspans)
+			left_a = a->span[i].len;
+		if (!(left_b -= n) && ++j < b->nspans)
+			left_b = b->span[j].len;
+	}
+	return true;
+}
+
 /* Parse one line.  Returns new state.
    'syntax' is the loaded syntax definition for this buffer.
    'line' is advanced to start of next line.
-   Global array 'attr_buf' end up with coloring for each character of line (attr_len characters).
-   'state' is initial parser state for the line (0 is initial state). */
+   Global runs 'attr_buf' end up with coloring for each character of line (attr_len characters).
+   'state' is initial parser state for the line (0 is initial state).
+
+   The colors of the last few characters are kept in a small window, as
+   recoloring happens backwards, and are appended to attr_buf as the window
+   fills up; recoloring further back (which is rare) splits the runs. */
 
-uint32_t *attr_buf = 0;	
-int64_t attr_size = 0;
+attr_spans attr_buf;
 int64_t attr_len = 0;
+
+#define ATTR_TAIL 64
+
+/* Sets the color of character pos, which is in the window if it is not
+   smaller than flushed. */
+
+static inline void recolor(uint32_t * const tail, const int64_t flushed, const int64_t pos, const uint32_t color)
+{
+	if (pos >= flushed)
+		tail[pos - flushed] = color;
+	else if (pos >= 0)
+		attr_fill(&attr_buf, pos, 1, color);
+}
+
+/* Appends the first n colors of the window to attr_buf. */
+
+static void flush_tail(const uint32_t * const tail, const int n)
+{
+	for(int i = 0, j; i < n; i = j) {
+		for(j = i + 1; j < n && tail[j] == tail[i]; j++);
+		attr_append(&attr_buf, j - i, tail[i]);
+	}
+}
+
 int stack_count = 0;
 static int state_count = 0; /* Max transitions possible without cycling */
 
@@ -186,13 +503,12 @@ HIGHLIGHT_STATE parse(struct high_syntax * const syntax, line_desc * const ld, H
 			/* Current state */
 
 	unsigned char buf[24];			/* Name buffer (trunc after 23 characters) */
-	unsigned char lbuf[24];			/* Lower case version of name buffer */
-	unsigned char lsaved_s[24];		/* Lower case version of delimiter match buffer */
 	int buf_idx=0;				/* Index into buffer */
 	int c;					/* Current character */
 	int c_len;				/* Character length in bytes */
-	uint32_t *attr = attr_buf;
-	uint32_t *attr_end = attr_buf+attr_size;
+	uint32_t tail[ATTR_TAIL];		/* Colors of the last characters */
+	int ntail = 0;				/* No. characters in tail */
+	int64_t flushed = 0;			/* No. characters already in attr_buf */
 	int buf_en = 0;				/* Set for name buffering */
 	int ofst = 0;				/* record offset after we've stopped buffering */
 	int mark1 = 0;  			/* offset to mark start from current pos */
@@ -213,6 +529,7 @@ HIGHLIGHT_STATE parse(struct high_syntax * const syntax, line_desc * const ld, H
    h = (stack ? stack->syntax : syntax)->states[h_state.state];
 
 	buf[0]=0;				/* Forgot this originally... took 5 months to fix! */
+	attr_buf.nspans = attr_buf.len = 0;
 
 
 	/* Get next character */
@@ -222,6 +539,31 @@ HIGHLIGHT_STATE parse(struct high_syntax * const syntax, line_desc * const ld, H
 		int iters = -8; /* +8 extra iterations before cycle detect. */
 		int x;
 
+		/* Skip a run of characters that just keep us in the current state */
+		if (h->skip && p < q) {
+			const unsigned char * const r = skip_run(h->skip, p, q, h->delim && h_state.saved_s[1] == 0 ? h_state.saved_s[0] : -1, utf8);
+			const int n = r - p;
+			if (n) {
+				flush_tail(tail, ntail);
+				flushed += ntail;
+				ntail = 0;
+				attr_append(&attr_buf, n, h->color);
+				flushed += n;
+
+				if (buf_en) {
+					for(x=0;x!=n && buf_idx<23;++x)
+						buf[buf_idx++] = p[x];
+					buf[buf_idx] = 0;
+				}
+				else
+					ofst += n;
+				mark1 += n;
+				if (!mark_en)
+					mark2 += n;
+				p = r;
+			}
+		}
+
 		if (p == q) c = '\n';
 		else c = utf8 ? get_char((const char*)p, ENC_UTF8) : *p;
 
@@ -232,56 +574,44 @@ HIGHLIGHT_STATE parse(struct high_syntax * const syntax, line_desc * const ld, H
 		if (c < 0 || c > 255)
 			c = 0x1F;
 
-		/* Create or expand attribute array if necessary */
-		if(attr==attr_end) {
-			if(!attr_buf) {
-				attr_size = 1024;
-				attr_buf = joe_malloc(sizeof(int)*attr_size);
-				attr = attr_buf;
-			} else {
-				attr_buf = joe_realloc(attr_buf,sizeof(int)*(attr_size*2));
-				attr = attr_buf + attr_size;
-				attr_size *= 2;
-			}
-			attr_end = attr_buf + attr_size;
+		/* Make room in the window, keeping its second half for recoloring */
+		if (ntail == ATTR_TAIL) {
+			flush_tail(tail, ATTR_TAIL / 2);
+			memmove(tail, tail + ATTR_TAIL / 2, sizeof *tail * (ATTR_TAIL / 2));
+			flushed += ATTR_TAIL / 2;
+			ntail = ATTR_TAIL / 2;
 		}
 
-		/* Advance to next attribute position (note attr[-1] below) */
-		attr++;
+		/* Advance to next attribute position (note tail[ntail - 1] below) */
+		ntail++;
+		const int64_t pos = flushed + ntail;
 
 		/* Loop while noeat */
 		do {
 			/* Guard against infinite loops from buggy syntaxes */
 			if (iters++ > state_count) {
 				invalidate_state(&h_state);
+				flush_tail(tail, ntail);
+				attr_len = attr_buf.len - (p > q);
+				attr_truncate(&attr_buf, attr_len);
 				return h_state;
 			}
 
 			/* Color with current state */
-			attr[-1] = h->color;
+			tail[ntail - 1] = h->color;
 
 			/* Get command for this character */
 			if (h->delim && c == h_state.saved_s[0] && h_state.saved_s[1] == 0)
 				cmd = h->delim;
 			else
-				cmd = h->cmd[c];
-
-			/* Lowerize strings for case-insensitive matching */
-			if (cmd->ignore) {
-				zcpy(lbuf,buf);
-				lowerize(lbuf);
-				if (cmd->delim) {
-					zcpy(lsaved_s,h_state.saved_s);
-					lowerize(lsaved_s);
-				}
-			}
+				cmd = h->row[h->syntax->byte_class[c]];
 
-			/* Check for delimiter or keyword matches */
+			/* Check for delimiter or keyword matches (case-insensitive ones are matched in place) */
 			recolor_delimiter_or_keyword = 0;
-			if (cmd->delim && (cmd->ignore ? !zcmp(lsaved_s,lbuf) : !zcmp(h_state.saved_s,buf))) {
+			if (cmd->delim && (cmd->ignore ? !fold_cmp(h_state.saved_s,buf) : !zcmp(h_state.saved_s,buf))) {
 				cmd = cmd->delim;
 				recolor_delimiter_or_keyword = 1;
-			} else if (cmd->keywords && (cmd->ignore ? (kw_cmd=htfind(cmd->keywords,lbuf)) : (kw_cmd=htfind(cmd->keywords,buf)))) {
+			} else if (cmd->keywords && (kw_cmd=find_keyword(cmd->keywords,buf,cmd->ignore))) {
 				cmd = kw_cmd;
 				recolor_delimiter_or_keyword = 1;
 			}
@@ -327,15 +657,14 @@ HIGHLIGHT_STATE parse(struct high_syntax * const syntax, line_desc * const ld, H
 			/* Recolor if necessary */
 			if (recolor_delimiter_or_keyword)
 				for(x= -(buf_idx+1);x<-1;++x)
-					attr[x-ofst] = h->color;
+					recolor(tail, flushed, pos + x - ofst, h->color);
 			for(x=cmd->recolor;x<0;++x)
-				if (attr + x >= attr_buf)
-					attr[x] = h->color;
+				recolor(tail, flushed, pos + x, h->color);
 
 			/* Mark recoloring */
 			if (cmd->recolor_mark)
 				for(x= -mark1;x<-mark2;++x)
-					attr[x] = h->color;
+					recolor(tail, flushed, pos + x, h->color);
 
 			/* Save string? */
 			if (cmd->save_s)
@@ -403,7 +732,9 @@ HIGHLIGHT_STATE parse(struct high_syntax * const syntax, line_desc * const ld, H
 	/* Return new state */
 	h_state.stack = stack;
 	h_state.state = h->no;
-	attr_len = attr - attr_buf - 1; /* -1 because of the fake newline. */
+	flush_tail(tail, ntail);
+	attr_len = attr_buf.len - 1; /* -1 because of the fake newline. */
+	attr_truncate(&attr_buf, attr_len);
 	return h_state;
 }
 
@@ -423,6 +754,10 @@ static struct high_state *find_state(struct high_syntax *syntax,unsigned char *n
 		state->name=zdup(name);
 		state->no=syntax->nstates;
 		state->color=FG_WHITE;
+		state->cmd=joe_malloc(sizeof(struct high_cmd *)*256);
+		state->row=0;
+		state->skip=0;
+		state->syntax=syntax;
 		/* Expand the state table if necessary */
 		if(syntax->nstates==syntax->szstates)
 			syntax->states=joe_realloc(syntax->states,sizeof(struct high_state *)*(syntax->szstates*=2));
@@ -465,6 +800,51 @@ static struct high_cmd *mkcmd()
 	return cmd;
 }
 
+/* Add the keyword name, with command cmd, to *kw (allocating it if necessary),
+   replacing the previous command if name is already present. The name is
+   not duplicated. */
+
+static void add_keyword(struct high_keywords **kw, unsigned char *name, struct high_cmd *cmd)
+{
+	struct high_keywords *k = *kw;
+	unsigned h = 0;
+	int len, i;
+
+	if (!k) {
+		k = *kw = joe_malloc(sizeof(struct high_keywords));
+		k->n = 0;
+		k->mask = 15;
+		k->slot = joe_calloc(k->mask + 1, sizeof(struct high_keyword));
+	}
+	else if (2 * (k->n + 1) > k->mask + 1) {
+		/* Double the table */
+		struct high_keyword * const old = k->slot;
+		const unsigned old_size = k->mask + 1;
+		unsigned j;
+		k->mask = 2 * old_size - 1;
+		k->slot = joe_calloc(k->mask + 1, sizeof(struct high_keyword));
+		for(j=0;j!=old_size;++j)
+			if (old[j].name) {
+				for(i=old[j].hash&k->mask;k->slot[i].name;i=(i+1)&k->mask);
+				k->slot[i] = old[j];
+			}
+		joe_free(old);
+	}
+
+	for(len=0;name[len];++len)
+		h = kw_hash(h, name[len]);
+	for(i=h&k->mask;k->slot[i].name;i=(i+1)&k->mask)
+		if (k->slot[i].hash == h && !zcmp(k->slot[i].name, name)) {
+			k->slot[i].cmd = cmd;
+			return;
+		}
+	k->slot[i].name = name;
+	k->slot[i].len = len;
+	k->slot[i].hash = h;
+	k->slot[i].cmd = cmd;
+	k->n++;
+}
+
 /* Globally defined colors */
 
 struct high_color *global_colors;
@@ -590,6 +970,22 @@ struct high_syntax *load_syntax_subr(unsigned char *name,unsigned char *subr,str
 
 /* Parse options */
 
+/* Keywords are collected in a hash table while parsing, and then moved to
+   the keyword table of the command. Only the entries found by htfind() are
+   moved, so duplicate keywords are resolved as before. */
+
+struct compile_keywords {
+	HASH *keywords;
+	struct high_keywords **kw;
+};
+
+static void compile_keyword(unsigned char *name, void *val, void *arg)
+{
+	struct compile_keywords * const ck = arg;
+	if (htfind(ck->keywords, name) == val)
+		add_keyword(ck->kw, name, val);
+}
+
 void parse_options(struct high_syntax *syntax,struct high_cmd *cmd,FILE *f,unsigned char *p,int parsing_strings,unsigned char *name,int line)
 {
 	unsigned char buf[1024];
@@ -638,6 +1034,7 @@ void parse_options(struct high_syntax *syntax,struct high_cmd *cmd,FILE *f,unsig
 		} else if(!zcmp(bf,USTR "reset")) {
 			cmd->reset = 1;
 		} else if(!parsing_strings && (!zcmp(bf,USTR "strings") || !zcmp(bf,USTR "istrings"))) {
+			HASH *keywords = 0;
 			if (bf[0]=='i')
 				cmd->ignore = 1;
 			while(fgets((char *)buf,1023,f)) {
@@ -658,9 +1055,9 @@ void parse_options(struct high_syntax *syntax,struct high_cmd *cmd,FILE *f,unsig
 							if (!zcmp(bf, USTR "&")) {
 								cmd->delim = kw_cmd;
 							} else {
-								if(!cmd->keywords)
-									cmd->keywords = htmk(64);
-								htadd(cmd->keywords,zdup(bf),kw_cmd);
+								if(!keywords)
+									keywords = htmk(64);
+								htadd(keywords,zdup(bf),kw_cmd);
 							}
 							parse_options(syntax,kw_cmd,f,p,1,name,line);
 						} else
@@ -669,6 +1066,11 @@ void parse_options(struct high_syntax *syntax,struct high_cmd *cmd,FILE *f,unsig
 						i_printf_2((char *)joe_gettext(_("%s %d: Missing string\n")),name,line);
 				}
 			}
+			if (keywords) {
+				struct compile_keywords ck = { keywords, &cmd->keywords };
+				htall(keywords, compile_keyword, &ck);
+				htrm(keywords);
+			}
 		} else if(!zcmp(bf,USTR "noeat")) {
 			cmd->noeat = 1;
 		} else if(!zcmp(bf,USTR "mark")) {
@@ -689,6 +1091,29 @@ struct ifstack {
 	int line;
 };
 
+/* Store in name the path of the file defining the syntax syn_name, looking
+   first in the local and then in the global syntax directory, and its status
+   in st. Return 0 if there is no such file. */
+
+static int find_syntax_file(const unsigned char *syn_name, unsigned char *name, size_t size, struct stat *st)
+{
+	const char *p;
+
+	if ((p = exists_prefs_dir()) && strlen(p) + 2 + strlen(SYNTAX_DIR) + strlen(SYNTAX_EXT) + strlen((const char *)syn_name) < size) {
+		strcat(strcat(strcat(strcat(strcpy((char *)name, p), SYNTAX_DIR), "/"), (const char *)syn_name), SYNTAX_EXT);
+		if (!stat((char *)name, st) && S_ISREG(st->st_mode))
+			return 1;
+	}
+
+	if ((p = exists_gprefs_dir()) && strlen(p) + 2 + strlen(SYNTAX_DIR) + strlen(SYNTAX_EXT) + strlen((const char *)syn_name) < size) {
+		strcat(strcat(strcat(strcat(strcpy((char *)name, p), SYNTAX_DIR), "/"), (const char *)syn_name), SYNTAX_EXT);
+		if (!stat((char *)name, st) && S_ISREG(st->st_mode))
+			return 1;
+	}
+
+	return 0;
+}
+
 /* Load dfa */
 
 struct high_state *load_dfa(struct high_syntax *syntax)
@@ -707,19 +1132,14 @@ struct high_state *load_dfa(struct high_syntax *syntax)
 	int this_one = 0;
 	int inside_subr = 0;
 
-	/* Load it */
-
-	if ((p = (unsigned char *)exists_prefs_dir()) && strlen((const char *)p) + 2 + strlen(SYNTAX_DIR) + strlen(SYNTAX_EXT) + strlen((const char *)syntax->name) < sizeof name) {
-		strcat(strcat(strcat(strcat(strcpy((char *)name, (const char *)p), SYNTAX_DIR), "/"), (const char *)syntax->name), SYNTAX_EXT);
-		f = fopen((char *)name,"r");
-	}
+	struct stat st;
 
-	if (!f && (p = (unsigned char*)exists_gprefs_dir()) && strlen((const char *)p) + 2 + strlen(SYNTAX_DIR) + strlen(SYNTAX_EXT) + strlen((const char *)syntax->name) < sizeof name) {
-		strcat(strcat(strcat(strcat(strcpy((char *)name, (const char *)p), SYNTAX_DIR), "/"), (const char *)syntax->name), SYNTAX_EXT);
-		f = fopen((char *)name,"r");
-	}
+	/* Load it */
 
-	if (!f) return 0;
+	if (!find_syntax_file(syntax->name, name, sizeof name, &st) || !(f = fopen((char *)name,"r"))) return 0;
+	syntax->path = zdup(name);
+	syntax->mtime = st.st_mtime;
+	syntax->size = st.st_size;
 
 	/* Parse file */
 	while(fgets((char *)buf,1023,f)) {
@@ -828,7 +1248,16 @@ struct high_state *load_dfa(struct high_syntax *syntax)
 			} else
 				i_printf_2((char *)joe_gettext(_("%s %d: Missing state name\n")),name,line);
 		} else if(!parse_char(&p, '-')) {
-			/* No. sync lines ignored */
+			/* No. sync lines, optionally followed by a sync pattern. They are
+			   used only when highlighting large files (see SyncLines). */
+			parse_int(&p, &syntax->sync_lines);
+			parse_ws(&p, '#');
+			if (*p == '"') {
+				if (parse_string(&p, bf, sizeof(bf)) < 0)
+					i_printf_2((char *)joe_gettext(_("%s %d: Bad string\n")),name,line);
+				else
+					syntax->sync_pattern = zdup(bf);
+			}
 		} else {
 			c = parse_ws(&p,'#');
 
@@ -896,6 +1325,85 @@ struct high_state *load_dfa(struct high_syntax *syntax)
 	return first;
 }
 
+/* A command is a plain loop of state if it just keeps the parser in state. */
+
+static int plain_loop(const struct high_cmd * const cmd, const struct high_state * const state)
+{
+	return cmd->new_state == state && !cmd->noeat && !cmd->start_buffering && !cmd->stop_buffering && !cmd->save_c && !cmd->save_s
+		&& !cmd->start_mark && !cmd->stop_mark && !cmd->recolor_mark && !cmd->rtn && !cmd->reset && !cmd->recolor
+		&& !cmd->keywords && !cmd->delim && !cmd->call;
+}
+
+/* Find the states that loop on most bytes (e.g., comments and strings), and
+   record for each of them the bytes that may leave it, so that parse() can
+   skip runs of the other ones. If there are just a few of them, we also
+   prepare words for scanning eight bytes at a time. */
+
+static void compile_skip(struct high_syntax *syntax)
+{
+	int c, n, s;
+
+	for(s=0;s!=syntax->nstates;++s) {
+		struct high_state * const state = syntax->states[s];
+		struct high_skip *skip;
+		for(c=n=0;c!=256;++c)
+			n += plain_loop(state->row[syntax->byte_class[c]], state);
+		if (n < 128)
+			continue;
+		skip = state->skip = joe_malloc(sizeof(struct high_skip));
+		memset(skip, 0, sizeof *skip);
+		for(c=0;c!=256;++c)
+			if (!plain_loop(state->row[syntax->byte_class[c]], state)) {
+				skip->stop[c >> 5] |= 1U << (c & 31);
+				if (c >= 0x80)
+					skip->high = true;
+				else if (skip->nwords >= 0) {
+					if (skip->nwords == sizeof skip->word / sizeof *skip->word)
+						skip->nwords = -1;
+					else
+						skip->word[skip->nwords++] = c * 0x0101010101010101ULL;
+				}
+			}
+	}
+}
+
+/* Compile the character tables of the states of a syntax into a single
+   table. Bytes that select the same command in every state are merged into
+   a class, so rows are usually much shorter than 256 entries. The character
+   tables are then freed. */
+
+static void compile_dfa(struct high_syntax *syntax)
+{
+	unsigned char rep[256];	/* A byte of each class */
+	int c, d, s;
+
+	/* Byte classes */
+	syntax->nclasses = 0;
+	for(c=0;c!=256;++c) {
+		for(d=0;d!=syntax->nclasses;++d) {
+			for(s=0;s!=syntax->nstates && syntax->states[s]->cmd[c]==syntax->states[s]->cmd[rep[d]];++s);
+			if(s==syntax->nstates)
+				break;
+		}
+		if(d==syntax->nclasses)
+			rep[syntax->nclasses++] = c;
+		syntax->byte_class[c] = d;
+	}
+
+	/* Rows */
+	syntax->table = joe_malloc(sizeof(struct high_cmd *)*syntax->nstates*syntax->nclasses);
+	for(s=0;s!=syntax->nstates;++s) {
+		struct high_state *state = syntax->states[s];
+		state->row = syntax->table + s*syntax->nclasses;
+		for(d=0;d!=syntax->nclasses;++d)
+			state->row[d] = state->cmd[rep[d]];
+		joe_free(state->cmd);
+		state->cmd = 0;
+	}
+
+	compile_skip(syntax);
+}
+
 int syntax_match(struct high_syntax *syntax,unsigned char *name,unsigned char *subr,struct high_param *params)
 {
 	struct high_param *syntax_params;
@@ -939,10 +1447,14 @@ struct high_syntax *load_syntax_subr(unsigned char *name,unsigned char *subr,str
 	iz_cmd(&syntax->default_cmd);
 	syntax->default_cmd.reset = 1;
 	syntax->stack_base = 0;
+	syntax->sync_lines = 0;
+	syntax->sync_pattern = 0;
+	syntax->path = 0;
 	syntax_list = syntax;
 
 	if (load_dfa(syntax)) {
 		/* dump_syntax(syntax); */
+		compile_dfa(syntax);
 		return syntax;
 	} else {
 		if(syntax_list == syntax)
@@ -960,10 +1472,524 @@ struct high_syntax *load_syntax_subr(unsigned char *name,unsigned char *subr,str
 	}
 }
 
+/* Compiled syntax cache. After a syntax has been loaded from its .jsf file,
+   the syntax and all the subroutines it calls are written to a file in the
+   SYNTAX_CACHE_DIR subdirectory of the local preferences directory. The next
+   time the syntax is needed, the file is read in a single read() and the
+   syntax is rebuilt without parsing anything, provided that the .jsf files
+   it was compiled from did not change.
+
+   The cache file contains integers (int64_t in host order) and strings
+   (their length followed by their bytes and a NUL; length -1 denotes NULL).
+   After a magic string and a version number, we have the number of syntaxes,
+   their headers (name, subroutine, parameters, source path, mtime and size),
+   and then their bodies, each preceded by its length, so that bodies of
+   syntaxes that are already loaded can be skipped. States and commands are
+   referenced by their index within their syntax (command 0 is the default
+   command), and syntaxes by their index within the file. */
+
+#define CACHE_MAGIC "ne syntax cache\n"
+#define CACHE_VERSION 1
+
+/* Sets of commands and syntaxes to be saved. */
+
+struct ptr_set {
+	void **p;
+	int n, size;
+};
+
+static int ptr_index(struct ptr_set *set, void *p)
+{
+	int i;
+	for(i=0;i!=set->n;++i)
+		if (set->p[i] == p)
+			return i;
+	return -1;
+}
+
+static int ptr_add(struct ptr_set *set, void *p)
+{
+	int i = ptr_index(set, p);
+	if (i >= 0)
+		return 0;
+	if (set->n == set->size)
+		set->p = joe_realloc(set->p, sizeof(void *) * (set->size = set->size ? set->size * 2 : 64));
+	set->p[set->n++] = p;
+	return 1;
+}
+
+/* Collect cmd and the commands it refers to. */
+
+static void collect_cmd(struct ptr_set *cmds, struct ptr_set *syntaxes, struct high_cmd *cmd)
+{
+	unsigned i;
+
+	if (!cmd || !ptr_add(cmds, cmd))
+		return;
+	if (cmd->call)
+		ptr_add(syntaxes, cmd->call);
+	collect_cmd(cmds, syntaxes, cmd->delim);
+	if (cmd->keywords)
+		for(i=0;i<=cmd->keywords->mask;++i)
+			collect_cmd(cmds, syntaxes, cmd->keywords->slot[i].cmd);
+}
+
+static void put_int(FILE *f, int64_t x)
+{
+	fwrite(&x, sizeof x, 1, f);
+}
+
+static void put_str(FILE *f, const unsigned char *s)
+{
+	if (s) {
+		const size_t len = strlen((const char *)s);
+		put_int(f, len);
+		fwrite(s, 1, len + 1, f);
+	}
+	else put_int(f, -1);
+}
+
+static void put_syntax_body(FILE *f, struct high_syntax *syntax, struct ptr_set *syntaxes)
+{
+	struct ptr_set cmds_set = { 0, 0, 0 }, * const cmds = &cmds_set;
+	int i, j;
+
+	collect_cmd(cmds, syntaxes, &syntax->default_cmd);
+	for(i=0;i!=syntax->nstates;++i) {
+		collect_cmd(cmds, syntaxes, syntax->states[i]->delim);
+		for(j=0;j!=syntax->nclasses;++j)
+			collect_cmd(cmds, syntaxes, syntax->states[i]->row[j]);
+	}
+
+	put_int(f, syntax->nstates);
+	put_int(f, syntax->nclasses);
+	fwrite(syntax->byte_class, 1, sizeof syntax->byte_class, f);
+	put_int(f, syntax->sync_lines);
+	put_str(f, syntax->sync_pattern);
+	put_int(f, cmds->n);
+
+	for(i=0;i!=syntax->nstates;++i) {
+		struct high_state *state = syntax->states[i];
+		put_str(f, state->name);
+		put_int(f, state->color);
+		put_int(f, state->delim ? ptr_index(cmds, state->delim) : -1);
+		for(j=0;j!=syntax->nclasses;++j)
+			put_int(f, ptr_index(cmds, state->row[j]));
+	}
+
+	for(i=0;i!=cmds->n;++i) {
+		struct high_cmd *cmd = cmds->p[i];
+		put_int(f, cmd->noeat | cmd->start_buffering << 1 | cmd->stop_buffering << 2 | cmd->save_c << 3 | cmd->save_s << 4 | cmd->ignore << 5
+			| cmd->start_mark << 6 | cmd->stop_mark << 7 | cmd->recolor_mark << 8 | cmd->rtn << 9 | cmd->reset << 10);
+		put_int(f, cmd->recolor);
+		put_int(f, cmd->new_state ? cmd->new_state->no : -1);
+		put_int(f, cmd->delim ? ptr_index(cmds, cmd->delim) : -1);
+		put_int(f, cmd->call ? ptr_index(syntaxes, cmd->call) : -1);
+		put_int(f, cmd->keywords ? cmd->keywords->n : 0);
+		if (cmd->keywords)
+			for(j=0;j<=(int)cmd->keywords->mask;++j)
+				if (cmd->keywords->slot[j].name) {
+					put_str(f, cmd->keywords->slot[j].name);
+					put_int(f, ptr_index(cmds, cmd->keywords->slot[j].cmd));
+				}
+	}
+
+	joe_free(cmds->p);
+}
+
+/* Store in name the name of the cache file of the syntax syn_name. Return 0 on failure. */
+
+static int cache_file_name(const unsigned char *syn_name, char *name, size_t size)
+{
+	const char *p = exists_prefs_dir();
+	if (!p || strlen(p) + 2 + strlen(SYNTAX_CACHE_DIR) + strlen(SYNTAX_CACHE_EXT) + strlen((const char *)syn_name) >= size)
+		return 0;
+	strcat(strcat(strcat(strcat(strcpy(name, p), SYNTAX_CACHE_DIR), "/"), (const char *)syn_name), SYNTAX_CACHE_EXT);
+	return 1;
+}
+
+static void save_syntax_cache(struct high_syntax *syntax)
+{
+	struct ptr_set syntaxes = { 0, 0, 0 };
+	char name[1024], tmp_name[1040];
+	struct high_param *param;
+	FILE *f;
+	int i, n;
+
+	if (!cache_file_name(syntax->name, name, sizeof name))
+		return;
+	*strrchr(name, '/') = 0;
+	mkdir(name, 0700);
+	name[strlen(name)] = '/';
+	snprintf(tmp_name, sizeof tmp_name, "%s.%d", name, (int)getpid());
+	if (!(f = fopen(tmp_name, "wb")))
+		return;
+
+	fwrite(CACHE_MAGIC, 1, strlen(CACHE_MAGIC), f);
+	put_int(f, CACHE_VERSION);
+
+	/* Syntaxes called by the bodies are appended to the set as we go, so we
+	   write the bodies to a temporary file, and then the headers. */
+	FILE * const body = tmpfile();
+	if (!body) {
+		fclose(f);
+		remove(tmp_name);
+		return;
+	}
+
+	ptr_add(&syntaxes, syntax);
+	for(i=0;i!=syntaxes.n;++i) {
+		const long start = ftell(body);
+		put_int(body, 0);
+		put_syntax_body(body, syntaxes.p[i], &syntaxes);
+		const long end = ftell(body);
+		fseek(body, start, SEEK_SET);
+		put_int(body, end - start - sizeof(int64_t));
+		fseek(body, end, SEEK_SET);
+	}
+
+	put_int(f, syntaxes.n);
+	for(i=0;i!=syntaxes.n;++i) {
+		struct high_syntax *s = syntaxes.p[i];
+		put_str(f, s->name);
+		put_str(f, s->subr);
+		for(n=0,param=s->params;param;param=param->next) ++n;
+		put_int(f, n);
+		for(param=s->params;param;param=param->next)
+			put_str(f, param->name);
+		put_str(f, s->path);
+		put_int(f, s->mtime);
+		put_int(f, s->size);
+	}
+
+	rewind(body);
+	while((n = fread(name, 1, sizeof name, body)) > 0)
+		fwrite(name, 1, n, f);
+
+	const bool error = ferror(body) || ferror(f);
+	fclose(body);
+	if (fclose(f) || error || !cache_file_name(syntax->name, name, sizeof name) || rename(tmp_name, name))
+		remove(tmp_name);
+	joe_free(syntaxes.p);
+}
+
+/* Reading from the cache. Strings are not copied: they point into the
+   cache buffer, which is freed only if the cache turns out to be invalid. */
+
+struct cache_reader {
+	unsigned char *p, *end;
+	int error;
+};
+
+static int64_t get_int(struct cache_reader *r)
+{
+	int64_t x;
+	if (r->end - r->p < (ptrdiff_t)sizeof x) {
+		r->error = 1;
+		return -1;
+	}
+	memcpy(&x, r->p, sizeof x);
+	r->p += sizeof x;
+	return x;
+}
+
+/* Return an integer that must be in [min..max). */
+
+static int64_t get_index(struct cache_reader *r, int64_t min, int64_t max)
+{
+	const int64_t x = get_int(r);
+	if (x < min || x >= max)
+		r->error = 1;
+	return r->error ? min : x;
+}
+
+static unsigned char *get_str(struct cache_reader *r)
+{
+	const int64_t len = get_int(r);
+	unsigned char *s = r->p;
+	if (len < 0 || r->end - r->p <= len || s[len] != 0) {
+		if (len != -1)
+			r->error = 1;
+		return 0;
+	}
+	r->p += len + 1;
+	return s;
+}
+
+/* Rebuild the body of syntax from the cache. Return the array of its
+   commands, whose length is stored in *ncmds_ptr, or 0 if no command has been
+   allocated. */
+
+static struct high_cmd **get_syntax_body(struct cache_reader *r, struct high_syntax *syntax, struct high_syntax **syntaxes, int nsyntaxes, int *ncmds_ptr)
+{
+	struct high_cmd **cmds;
+	int i, j, ncmds;
+
+	syntax->nstates = syntax->szstates = get_index(r, 1, INT_MAX);
+	syntax->nclasses = get_index(r, 1, 257);
+	if (r->error || r->end - r->p < (ptrdiff_t)sizeof syntax->byte_class)
+		goto error;
+	memcpy(syntax->byte_class, r->p, sizeof syntax->byte_class);
+	r->p += sizeof syntax->byte_class;
+	for(i=0;i!=256;++i)
+		if (syntax->byte_class[i] >= syntax->nclasses)
+			goto error;
+	syntax->sync_lines = get_int(r);
+	syntax->sync_pattern = get_str(r);
+	ncmds = get_index(r, 1, INT_MAX);
+	if (r->error || (r->end - r->p) / (int64_t)sizeof(int64_t) < syntax->nstates * (int64_t)(syntax->nclasses + 3) + ncmds * (int64_t)6)
+		goto error;
+
+	*ncmds_ptr = ncmds;
+	cmds = joe_malloc(sizeof(struct high_cmd *) * ncmds);
+	cmds[0] = &syntax->default_cmd;
+	for(i=1;i!=ncmds;++i)
+		cmds[i] = mkcmd();
+
+	syntax->states = joe_malloc(sizeof(struct high_state *) * syntax->nstates);
+	syntax->table = joe_malloc(sizeof(struct high_cmd *) * syntax->nstates * syntax->nclasses);
+	for(i=0;i!=syntax->nstates;++i) {
+		struct high_state *state = syntax->states[i] = joe_malloc(sizeof(struct high_state));
+		state->name = get_str(r);
+		state->no = i;
+		state->color = get_int(r);
+		j = get_index(r, -1, ncmds);
+		state->delim = j >= 0 ? cmds[j] : 0;
+		state->cmd = 0;
+		state->row = syntax->table + i * syntax->nclasses;
+		state->skip = 0;
+		state->syntax = syntax;
+		for(j=0;j!=syntax->nclasses;++j)
+			state->row[j] = cmds[get_index(r, 0, ncmds)];
+	}
+
+	for(i=0;i!=ncmds && !r->error;++i) {
+		struct high_cmd *cmd = cmds[i];
+		const int64_t flags = get_int(r);
+		cmd->noeat = flags & 1;
+		cmd->start_buffering = flags >> 1 & 1;
+		cmd->stop_buffering = flags >> 2 & 1;
+		cmd->save_c = flags >> 3 & 1;
+		cmd->save_s = flags >> 4 & 1;
+		cmd->ignore = flags >> 5 & 1;
+		cmd->start_mark = flags >> 6 & 1;
+		cmd->stop_mark = flags >> 7 & 1;
+		cmd->recolor_mark = flags >> 8 & 1;
+		cmd->rtn = flags >> 9 & 1;
+		cmd->reset = flags >> 10 & 1;
+		cmd->recolor = get_int(r);
+		j = get_index(r, -1, syntax->nstates);
+		cmd->new_state = j >= 0 ? syntax->states[j] : 0;
+		j = get_index(r, -1, ncmds);
+		cmd->delim = j >= 0 ? cmds[j] : 0;
+		j = get_index(r, -1, nsyntaxes);
+		cmd->call = j >= 0 ? syntaxes[j] : 0;
+		j = get_index(r, 0, INT_MAX);
+		while(j-- && !r->error) {
+			unsigned char *kw = get_str(r);
+			struct high_cmd *kw_cmd = cmds[get_index(r, 0, ncmds)];
+			if (kw)
+				add_keyword(&cmd->keywords, kw, kw_cmd);
+			else
+				r->error = 1;
+		}
+	}
+
+	if (!r->error) {
+		compile_skip(syntax);
+		state_count += syntax->nstates;
+	}
+	return cmds;
+
+	error:
+	r->error = 1;
+	return 0;
+}
+
+/* Free the body of a syntax rebuilt by get_syntax_body(), given the array of
+   its commands. Strings point into the cache buffer, so they are not freed. */
+
+static void free_syntax_body(struct high_syntax *syntax, struct high_cmd **cmds, int ncmds)
+{
+	int i;
+
+	for(i=0;i!=ncmds;++i) {
+		if (cmds[i]->keywords) {
+			joe_free(cmds[i]->keywords->slot);
+			joe_free(cmds[i]->keywords);
+		}
+		if (i)
+			joe_free(cmds[i]);
+	}
+	joe_free(cmds);
+
+	for(i=0;i!=syntax->nstates;++i) {
+		joe_free(syntax->states[i]->skip);
+		joe_free(syntax->states[i]);
+	}
+	joe_free(syntax->states);
+	joe_free(syntax->table);
+}
+
+/* Free a list of parameters read from the cache (their names point into the
+   cache buffer). */
+
+static void free_params(struct high_param *params)
+{
+	while(params) {
+		struct high_param * const next = params->next;
+		joe_free(params);
+		params = next;
+	}
+}
+
+/* Load the syntax syn_name from its cache file, if the file is valid. */
+
+static struct high_syntax *load_syntax_cache(unsigned char *syn_name)
+{
+	struct high_syntax **syntaxes, *syntax;
+	struct high_cmd ***cmds;
+	struct cache_reader r;
+	unsigned char name[1024];
+	struct stat st;
+	unsigned char *buf;
+	int i, n, fd, *ncmds;
+	bool *loaded;
+
+	if (!cache_file_name(syn_name, (char *)name, sizeof name) || (fd = open((char *)name, O_RDONLY)) < 0)
+		return 0;
+	if (fstat(fd, &st) || st.st_size < (off_t)strlen(CACHE_MAGIC) || !(buf = malloc(st.st_size))) {
+		close(fd);
+		return 0;
+	}
+	if (read(fd, buf, st.st_size) != st.st_size || memcmp(buf, CACHE_MAGIC, strlen(CACHE_MAGIC))) {
+		close(fd);
+		free(buf);
+		return 0;
+	}
+	close(fd);
+
+	r.p = buf + strlen(CACHE_MAGIC);
+	r.end = buf + st.st_size;
+	r.error = 0;
+	n = get_int(&r) == CACHE_VERSION ? get_index(&r, 1, 4096) : 0;
+	if (!n) {
+		free(buf);
+		return 0;
+	}
+
+	/* Headers: we check that the source files did not change, and we reuse
+	   syntaxes that are already loaded. */
+	syntaxes = joe_malloc(sizeof(struct high_syntax *) * n);
+	loaded = joe_malloc(sizeof(bool) * n);
+	cmds = joe_calloc(n, sizeof(struct high_cmd **));
+	ncmds = joe_calloc(n, sizeof(int));
+	for(i=0;i!=n;++i)
+		loaded[i] = true;
+	for(i=0;i!=n && !r.error;++i) {
+		struct high_param *params = 0, **param_ptr = &params;
+		unsigned char *s_name = get_str(&r), *subr = get_str(&r), *path;
+		int nparams = get_index(&r, 0, INT_MAX);
+		while(nparams-- && !r.error) {
+			*param_ptr = joe_malloc(sizeof(struct high_param));
+			(*param_ptr)->name = get_str(&r);
+			param_ptr = &(*param_ptr)->next;
+		}
+		*param_ptr = 0;
+		path = get_str(&r);
+		const int64_t mtime = get_int(&r), size = get_int(&r);
+
+		if (r.error || !s_name || !path || (i == 0 && (zcmp(s_name, syn_name) || subr || params))
+			|| !find_syntax_file(s_name, name, sizeof name, &st) || zcmp(name, path) || st.st_mtime != mtime || st.st_size != size) {
+			free_params(params);
+			r.error = 1;
+			break;
+		}
+
+		for(syntax=syntax_list;syntax;syntax=syntax->next)
+			if(syntax_match(syntax,s_name,subr,params))
+				break;
+		if (syntax) {
+			free_params(params);
+			syntaxes[i] = syntax;
+		}
+		else {
+			syntax = syntaxes[i] = joe_malloc(sizeof(struct high_syntax));
+			syntax->name = s_name;
+			syntax->subr = subr;
+			syntax->params = params;
+			syntax->nstates = 0;
+			syntax->states = 0;
+			syntax->table = 0;
+			syntax->ht_states = 0;
+			syntax->color = 0;
+			iz_cmd(&syntax->default_cmd);
+			syntax->stack_base = 0;
+			syntax->path = path;
+			syntax->mtime = mtime;
+			syntax->size = size;
+			loaded[i] = false;
+		}
+	}
+
+	/* Bodies */
+	for(i=0;i!=n && !r.error;++i) {
+		const int64_t len = get_index(&r, 0, r.end - r.p + 1);
+		if (loaded[i])
+			r.p += len;
+		else
+			cmds[i] = get_syntax_body(&r, syntaxes[i], syntaxes, n, &ncmds[i]);
+	}
+
+	syntax = 0;
+	if (!r.error) {
+		for(i=n;i--!=0;) {
+			joe_free(cmds[i]);
+			if (!loaded[i]) {
+				syntaxes[i]->next = syntax_list;
+				syntax_list = syntaxes[i];
+			}
+		}
+		syntax = syntaxes[0];
+	}
+	else {
+		/* The sources changed or the cache is damaged: we free everything
+		   we built, including the buffer, as nothing points into it. */
+		for(i=0;i!=n;++i)
+			if (!loaded[i]) {
+				free_params(syntaxes[i]->params);
+				if (cmds[i])
+					free_syntax_body(syntaxes[i], cmds[i], ncmds[i]);
+				joe_free(syntaxes[i]);
+			}
+		free(buf);
+	}
+	joe_free(syntaxes);
+	joe_free(loaded);
+	joe_free(cmds);
+	joe_free(ncmds);
+	return syntax;
+}
+
 struct high_syntax *load_syntax(unsigned char *name)
 {
+	struct high_syntax *syntax;
+
 	if (!name)
 		return 0;
 
-	return load_syntax_subr(name,0,0);
+	if (!fold['A'])
+		init_fold();
+
+	/* Already loaded? */
+	for(syntax=syntax_list;syntax;syntax=syntax->next)
+		if(syntax_match(syntax,name,0,0))
+			return syntax;
+
+	if ((syntax = load_syntax_cache(name)))
+		return syntax;
+
+	if ((syntax = load_syntax_subr(name,0,0)))
+		save_syntax_cache(syntax);
+	return syntax;
 }
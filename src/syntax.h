@@ -36,8 +36,21 @@ struct high_state {
 	int32_t no;				/* State number */
 	uint32_t color;			/* Color for this state */
 	unsigned char *name;		/* Highlight state name */
-	struct high_cmd *cmd[256];	/* Character table */
+	struct high_cmd **cmd;		/* Character table (only while loading) */
+	struct high_cmd **row;		/* Row of the compiled table (indexed by byte class) */
+	struct high_syntax *syntax;	/* Syntax this state belongs to */
 	struct high_cmd *delim;		/* Matching delimiter */
+	struct high_skip *skip;		/* Bytes that may leave the state, or NULL */
+};
+
+/* Bytes that may leave a state that loops on most of them (see
+   compile_skip() in syntax.c). */
+
+struct high_skip {
+	uint32_t stop[256 / 32];	/* Bitmap of the bytes */
+	bool high;			/* Some non-ASCII byte is in the bitmap */
+	int nwords;			/* No. ASCII bytes in the bitmap, or -1 if more than four */
+	uint64_t word[4];		/* Each of them, repeated in every byte of a word */
 };
 
 /* Parameter list */
@@ -63,11 +76,28 @@ struct high_cmd {
 	unsigned reset : 1;		/* Set to reset the call stack */
 	int recolor;			/* No. chars to recolor if <0. */
 	struct high_state *new_state;	/* The new state */
-	HASH *keywords;			/* Hash table of keywords */
+	struct high_keywords *keywords;	/* Table of keywords */
 	struct high_cmd *delim;		/* Matching delimiter */
 	struct high_syntax *call;	/* Syntax subroutine to call */
 };
 
+/* Keywords of a command, in an open-addressing table whose size is a
+   power of two at least twice the number of keywords. Case-insensitive
+   keywords are stored in lower case. */
+
+struct high_keyword {
+	unsigned char *name;		/* The keyword (NULL for an empty slot) */
+	int len;			/* Its length */
+	unsigned hash;			/* Its hash code */
+	struct high_cmd *cmd;		/* The command for the keyword */
+};
+
+struct high_keywords {
+	int n;				/* No. keywords */
+	unsigned mask;			/* Table size minus one */
+	struct high_keyword *slot;	/* The table */
+};
+
 /* Call stack frame */
 
 struct high_frame {
@@ -92,15 +122,34 @@ struct high_syntax {
 	struct high_color *color;	/* Linked list of color definitions */
 	struct high_cmd default_cmd;	/* Default transition for new states */
 	struct high_frame *stack_base;  /* Root of run-time call tree */
+	unsigned char byte_class[256];	/* Equivalence class of each byte in the compiled table */
+	int nclasses;			/* No. byte classes */
+	struct high_cmd **table;	/* Compiled table: nstates rows of nclasses commands */
+	int sync_lines;			/* No. sync lines (-N), or 0 for the default */
+	unsigned char *sync_pattern;	/* Lines matching this regex start in the idle state, or NULL */
+	unsigned char *path;		/* File this syntax was loaded from */
+	int64_t mtime;			/* Its modification time... */
+	int64_t size;			/* ...and its size when it was loaded */
 };
 
 /* Find a syntax.  Load it if necessary. */
 
 struct high_syntax *load_syntax PARAMS((unsigned char *name));
 
+/* Manipulate attribute runs. */
+
+void attr_append PARAMS((attr_spans *a, int64_t len, uint32_t attr));
+void attr_fill PARAMS((attr_spans *a, int64_t pos, int64_t len, uint32_t attr));
+void attr_insert PARAMS((attr_spans *a, int64_t pos, int64_t len, uint32_t attr));
+void attr_delete PARAMS((attr_spans *a, int64_t pos, int64_t len));
+void attr_truncate PARAMS((attr_spans *a, int64_t len));
+void attr_copy PARAMS((attr_spans *dst, const attr_spans *src));
+uint32_t attr_at PARAMS((const attr_spans *a, int64_t pos, int64_t *end));
+bool attr_equal PARAMS((const attr_spans *a, const attr_spans *b, int64_t len));
+
 /* Parse a lines.  Returns new state. */
 
-extern uint32_t *attr_buf;
+extern attr_spans attr_buf;
 extern int64_t attr_len;
 HIGHLIGHT_STATE parse PARAMS((struct high_syntax *syntax, line_desc *ld, HIGHLIGHT_STATE h_state, bool utf8));
 
@@ -25,6 +25,8 @@
 #include <stdlib.h>
 #include <ctype.h>
 #include <string.h>
+#include <limits.h>
+#include <time.h>
 
 #ifndef TERMCAP
 #include <curses.h>
@@ -35,6 +37,8 @@
 
 #include <termios.h>
 #include <sys/ioctl.h>
+#include <unistd.h>
+#include <errno.h>
 
 #include "term.h"
 #include "ansi.h"
@@ -60,6 +64,133 @@ bool ansi = true;
 bool ansi = false;
 #endif
 
+/* All output is gathered in a frame, which is written with a single write()
+   by flush_frame() (usually, right before waiting for input), so that a
+   refresh does not turn into many small writes. If the terminal advertises
+   synchronized output (the extended terminfo capability Sync), each frame
+   starts with the frame_start bytes that begin a synchronized update, and
+   room is always kept for appending sync_end. The initial buffer is static,
+   so that we can always make room by flushing. */
+
+static char initial_frame[4096];
+static char *frame = initial_frame;
+static size_t frame_len, frame_size = sizeof initial_frame, frame_start;
+static char *sync_end;
+static size_t sync_end_len;
+
+/* The number of bytes written so far, and statistics about the writes of
+   frames, used by link_estimate(): we fit the time spent writing a frame as
+   latency + bytes / bandwidth by least squares, weighting more recent frames. */
+
+#define LINK_DECAY .95
+#define LINK_MIN_WEIGHT 8
+
+static uint64_t bytes_written;
+static double link_w, link_n, link_t, link_nn, link_nt;
+
+/* Makes room for n more bytes in the frame, flushing it if we cannot enlarge it. */
+
+static void frame_make_room(const size_t n) {
+	if (frame_len + n + sync_end_len <= frame_size) return;
+
+	size_t new_size = frame_size * 2;
+	while(new_size < frame_len + n + sync_end_len) new_size *= 2;
+	char * const p = frame == initial_frame ? malloc(new_size) : realloc(frame, new_size);
+	if (p) {
+		if (frame == initial_frame) memcpy(p, frame, frame_len);
+		frame = p;
+		frame_size = new_size;
+	}
+	else flush_frame();
+}
+
+static void frame_write(const char * const s, const size_t n) {
+	frame_make_room(n);
+	if (frame_len + n + sync_end_len > frame_size) {
+		/* Out of memory, and too large even for an empty frame. */
+		write(fileno(stdout), s, n);
+		return;
+	}
+	memcpy(frame + frame_len, s, n);
+	frame_len += n;
+}
+
+/* The putchar()-like function used for all output (directly, or through tputs()). */
+
+int ne_putchar(const int c) {
+	if (frame_len + sync_end_len == frame_size) frame_make_room(1);
+	frame[frame_len++] = c;
+	return (unsigned char)c;
+}
+
+static void sync_cursor(void);
+
+/* Writes the current frame to the terminal, if it is not empty. */
+
+void flush_frame(void) {
+	sync_cursor();
+	if (frame_len == frame_start) return;
+	/* Anything written through stdio comes first. */
+	fflush(stdout);
+
+	bytes_written += frame_len - frame_start;
+	if (sync_end) {
+		memcpy(frame + frame_len, sync_end, sync_end_len);
+		frame_len += sync_end_len;
+	}
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for(size_t done = 0; done < frame_len;) {
+		const ssize_t r = write(fileno(stdout), frame + done, frame_len - done);
+		if (r < 0) {
+			if (errno == EINTR || errno == EAGAIN) continue;
+			break;
+		}
+		done += r;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	const double n = frame_len, t = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1E-9;
+	link_w = link_w * LINK_DECAY + 1;
+	link_n = link_n * LINK_DECAY + n;
+	link_t = link_t * LINK_DECAY + t;
+	link_nn = link_nn * LINK_DECAY + n * n;
+	link_nt = link_nt * LINK_DECAY + n * t;
+
+	frame_len = frame_start;
+}
+
+/* Returns the number of bytes output so far (including those still in the frame). */
+
+uint64_t output_count(void) {
+	return bytes_written + frame_len - frame_start;
+}
+
+/* Estimates the bandwidth (in bytes per second) and the latency (in seconds)
+   of the terminal link from the time spent writing frames. Returns false if
+   we have not written enough frames yet. */
+
+bool link_estimate(double * const bandwidth, double * const latency) {
+	if (link_w < LINK_MIN_WEIGHT) return false;
+	const double mean_n = link_n / link_w, mean_t = link_t / link_w;
+	const double var = link_nn / link_w - mean_n * mean_n, cov = link_nt / link_w - mean_n * mean_t;
+
+	if (var > 0 && cov > 0) {
+		*bandwidth = var / cov;
+		*latency = mean_t - mean_n / *bandwidth;
+		if (*latency < 0) *latency = 0;
+	}
+	else {
+		/* We cannot separate latency and bandwidth. */
+		if (mean_t <= 0) return false;
+		*bandwidth = mean_n / mean_t;
+		*latency = 0;
+	}
+	return true;
+}
+
 /* Value is non-zero if attribute ATTR may be used with color.  ATTR
    should be one of the enumerators from enum no_color_bit, or a bit set
    built from them. */
@@ -104,6 +235,11 @@ char *ne_cursor_down;
 char *ne_cursor_left;
 char *ne_cursor_up;
 
+char *ne_parm_right_cursor;
+char *ne_parm_down_cursor;
+char *ne_parm_left_cursor;
+char *ne_parm_up_cursor;
+
 int ne_auto_right_margin;
 int ne_eat_newline_glitch;
 
@@ -169,6 +305,11 @@ char *ne_set_window;
 char *ne_keypad_local;
 char *ne_keypad_xmit;
 
+char *ne_bracketed_paste_on;
+char *ne_bracketed_paste_off;
+char *ne_paste_start;
+char *ne_paste_end;
+
 char *ne_clr_eol;
 bool ne_transparent_underline;
 
@@ -222,11 +363,13 @@ static int	RPov;		/* Least number of chars to start a TS_repeat.
 static bool	delete_in_insert_mode;	/* True if delete mode == insert mode */
 static bool	se_is_so;					/* True if same string both enters and leaves standout mode */
 static bool	esm_is_eam;					/* True if exiting standout mode turns off all attributes */
+static bool	ecma48_sgr;					/* True if attributes and colors are set by standard SGR sequences */
 
 static bool	insert_mode;			/* True when in insert mode. */
 static bool	standout_mode;			/* True when in standout mode. */
 static bool	standout_wanted;		/* True if we should be writing in standout mode. */
 static uint32_t curr_attr;			/* The current video attributes. */
+static bool	curr_attr_unsure;		/* True if the terminal might not be displaying curr_attr. */
 
 /* Size of window specified by higher levels. This is the number of lines,
 starting from top of screen, to participate in ins/del line operations.
@@ -240,14 +383,26 @@ int	specified_window;
 bool	io_utf8;
 
 /* Returns the output width of the given character. It is maximised with 1
- w.r.t. wcwidth(), so its result is equivalent to the width of the character
+ w.r.t. unicode_width(), so its result is equivalent to the width of the character
  that will be output by out(). */
 
 int output_width(const int c) {
-	const int width = wcwidth(c);
+	const int width = unicode_width(c);
 	return width > 0 ? width : 1;
 }
 
+/* Returns the width of c if out() would output its encoding (UTF-8 if
+   utf8 is true, a single byte otherwise) unmodified and without additional
+   attributes, or 0 otherwise (see printable()). */
+
+static int verbatim_width(const int c, const bool utf8) {
+	if (c < 0x80) return c >= ' ' && c < 127;
+	if (c <= 160 || utf8 != io_utf8) return 0;
+	if (!io_utf8) return c <= 0xFF;
+	const int width = unicode_width(c);
+	return width > 0 ? width : 0;
+}
+
 /* Returns the output width of the given string. If s is NULL, returns len.  If
 the width of the string exceeds maxWidth, modifies len so that it contains the
 longest prefix of s whose width is not greater than maxWidth, and returns the
@@ -309,6 +464,7 @@ static int joe2color(const int joe_color) {
 
 void set_attr(const uint32_t attr) {
 	OUTPUT1(ne_exit_attribute_mode);
+	curr_attr = attr;
 
 	if (attr & INVERSE) OUTPUT1(ne_enter_reverse_mode); 
 	if (attr & BOLD) OUTPUT1(ne_enter_bold_mode);
@@ -330,27 +486,143 @@ void set_attr(const uint32_t attr) {
 
 #else
 
+/* If s ends with an ECMA-48 SGR sequence (ESC [ parameters m), returns a
+   pointer to its start; otherwise, returns NULL. */
+
+static const char *sgr_suffix(const char * const s) {
+	if (s == NULL) return NULL;
+	const char *p = s + strlen(s);
+	if (p == s || *--p != 'm') return NULL;
+	while(p > s && (isdigit((unsigned char)p[-1]) || p[-1] == ';' || p[-1] == ':')) p--;
+	return p - s >= 2 && p[-2] == '\033' && p[-1] == '[' ? p - 2 : NULL;
+}
+
+/* The parameters of an SGR sequence being built. */
+
+typedef struct {
+	char s[128];
+	int len;
+} sgr_params;
+
+static void add_param(sgr_params * const p, const char * const param, const int len) {
+	if (p->len + len + 1 >= sizeof p->s) return;
+	if (p->len != 0) p->s[p->len++] = ';';
+	memcpy(p->s + p->len, param, len);
+	p->len += len;
+}
+
+/* Adds the parameters of the SGR sequence in s (which must be one). */
+
+static void add_sgr(sgr_params * const p, const char * const s) {
+	const int len = strlen(s) - 3;
+	if (len == 0) add_param(p, "0", 1);
+	else add_param(p, s + 2, len);
+}
+
+/* Returns the attributes of attr that we can actually display. */
+
+static uint32_t usable_modes(const uint32_t attr) {
+	uint32_t modes = 0;
+	if ((attr & INVERSE) && MAY_USE_WITH_COLORS(NC_REVERSE) && ne_enter_reverse_mode) modes |= INVERSE;
+	if ((attr & BOLD) && MAY_USE_WITH_COLORS(NC_BOLD) && ne_enter_bold_mode) modes |= BOLD;
+	if ((attr & UNDERLINE) && MAY_USE_WITH_COLORS(NC_UNDERLINE) && ne_enter_underline_mode) modes |= UNDERLINE;
+	if ((attr & DIM) && MAY_USE_WITH_COLORS(NC_DIM) && ne_enter_dim_mode) modes |= DIM;
+	if ((attr & BLINK) && MAY_USE_WITH_COLORS(NC_BLINK) && ne_enter_blink_mode) modes |= BLINK;
+	return modes;
+}
+
+static void add_modes(sgr_params * const p, const uint32_t modes) {
+	if (modes & INVERSE) add_sgr(p, ne_enter_reverse_mode);
+	if (modes & BOLD) add_sgr(p, ne_enter_bold_mode);
+	if (modes & UNDERLINE) add_sgr(p, ne_enter_underline_mode);
+	if (modes & DIM) add_sgr(p, ne_enter_dim_mode);
+	if (modes & BLINK) add_sgr(p, ne_enter_blink_mode);
+}
+
+static void add_color(sgr_params * const p, const char * const cap, const uint32_t attr, const int shift) {
+	add_sgr(p, tparm(cap, joe2color(attr >> shift)));
+}
+
+/* Sets attributes on terminals using ECMA-48 SGR sequences. We build both
+   the parameters that reset everything and set the required attributes,
+   and those that change just what differs from the current attributes, and
+   output the shortest resulting sequence. */
+
+static void set_attr_sgr(const uint32_t attr) {
+	const uint32_t old_modes = usable_modes(curr_attr), new_modes = usable_modes(attr);
+	sgr_params reset = { .len = 0 }, delta = { .len = 0 };
+
+	add_param(&reset, "0", 1);
+	add_modes(&reset, new_modes);
+	if (color_ok) {
+		if (attr & FG_NOT_DEFAULT) add_color(&reset, ne_set_foreground, attr, FG_SHIFT);
+		if (attr & BG_NOT_DEFAULT) add_color(&reset, ne_set_background, attr, BG_SHIFT);
+	}
+
+	const uint32_t off = old_modes & ~new_modes;
+	uint32_t on = new_modes & ~old_modes;
+	/* There is a single parameter turning off both bold and dim. */
+	if (off & (BOLD | DIM)) {
+		add_param(&delta, "22", 2);
+		on |= new_modes & (BOLD | DIM);
+	}
+	if (off & UNDERLINE) add_param(&delta, "24", 2);
+	if (off & BLINK) add_param(&delta, "25", 2);
+	if (off & INVERSE) add_param(&delta, "27", 2);
+	add_modes(&delta, on);
+	if (color_ok) {
+		if ((attr & FG_MASK) != (curr_attr & FG_MASK)) {
+			if (attr & FG_NOT_DEFAULT) add_color(&delta, ne_set_foreground, attr, FG_SHIFT);
+			else add_param(&delta, "39", 2);
+		}
+		if ((attr & BG_MASK) != (curr_attr & BG_MASK)) {
+			if (attr & BG_NOT_DEFAULT) add_color(&delta, ne_set_background, attr, BG_SHIFT);
+			else add_param(&delta, "49", 2);
+		}
+	}
+
+	/* Resetting uses also whatever precedes the SGR sequence in sgr0. */
+	const int prefix_len = sgr_suffix(ne_exit_attribute_mode) - ne_exit_attribute_mode;
+	const sgr_params * const p = curr_attr_unsure || prefix_len + reset.len < delta.len ? &reset : &delta;
+	if (p->len != 0) {
+		if (p == &reset) frame_write(ne_exit_attribute_mode, prefix_len);
+		frame_write("\033[", 2);
+		frame_write(p->s, p->len);
+		ne_putchar('m');
+	}
+
+	curr_attr = attr;
+	curr_attr_unsure = false;
+}
+
 
 void set_attr(const uint32_t attr) {
+	if (attr == curr_attr && !curr_attr_unsure) return;
+	if (ecma48_sgr) {
+		set_attr_sgr(attr);
+		return;
+	}
+
 	bool attr_reset = false;
 
-	/* If we have to set a different subset of attributes, or if we have to
-		set to the default at least one of the colors
-		(background/foreground) we must necessarily reset all attributes. */
-	if ((curr_attr & AT_MASK) != (attr & AT_MASK) 
-			|| (!(attr & FG_NOT_DEFAULT) && (curr_attr & FG_NOT_DEFAULT)) 
+	/* If we have to turn off some attribute, or if we have to set to the
+		default at least one of the colors (background/foreground) we must
+		necessarily reset all attributes; otherwise, we just turn on the
+		missing attributes. */
+	if (curr_attr_unsure || (curr_attr & AT_MASK & ~attr)
+			|| (!(attr & FG_NOT_DEFAULT) && (curr_attr & FG_NOT_DEFAULT))
 			|| (!(attr & BG_NOT_DEFAULT) && (curr_attr & BG_NOT_DEFAULT))) {
-
 		OUTPUT1_IF(ne_exit_attribute_mode)
 		attr_reset = true;
-
-		if ((attr & INVERSE) && MAY_USE_WITH_COLORS(NC_REVERSE)) OUTPUT1_IF(ne_enter_reverse_mode)
-		if ((attr & BOLD) && MAY_USE_WITH_COLORS(NC_BOLD)) OUTPUT1_IF(ne_enter_bold_mode)
-		if ((attr & UNDERLINE) && MAY_USE_WITH_COLORS(NC_UNDERLINE)) OUTPUT1_IF(ne_enter_underline_mode)
-		if ((attr & DIM) && MAY_USE_WITH_COLORS(NC_DIM)) OUTPUT1_IF(ne_enter_dim_mode)
-		if ((attr & BLINK) && MAY_USE_WITH_COLORS(NC_BLINK)) OUTPUT1_IF(ne_enter_blink_mode)
 	}
 
+	const uint32_t on = attr_reset ? attr : attr & ~curr_attr;
+	if ((on & INVERSE) && MAY_USE_WITH_COLORS(NC_REVERSE)) OUTPUT1_IF(ne_enter_reverse_mode)
+	if ((on & BOLD) && MAY_USE_WITH_COLORS(NC_BOLD)) OUTPUT1_IF(ne_enter_bold_mode)
+	if ((on & UNDERLINE) && MAY_USE_WITH_COLORS(NC_UNDERLINE)) OUTPUT1_IF(ne_enter_underline_mode)
+	if ((on & DIM) && MAY_USE_WITH_COLORS(NC_DIM)) OUTPUT1_IF(ne_enter_dim_mode)
+	if ((on & BLINK) && MAY_USE_WITH_COLORS(NC_BLINK)) OUTPUT1_IF(ne_enter_blink_mode)
+
 	if (color_ok) {
 		/* Colors must be set if attributes have been reset and the required
 			color is not default, or in any case if the color has changed. */
@@ -370,6 +642,7 @@ void set_attr(const uint32_t attr) {
 	}
 
 	curr_attr = attr;
+	curr_attr_unsure = false;
 }
 
 #endif
@@ -378,6 +651,8 @@ static void turn_off_standout(void) {
 	OUTPUT1(ne_exit_standout_mode);
 	/* We exiting standout mode deletes all attributes, we update curr_attr. */
 	if (esm_is_eam) curr_attr = 0;
+	/* Otherwise, it might have turned off some of them (e.g., reverse). */
+	else curr_attr_unsure = true;
 	standout_mode = false;
 }
 
@@ -403,84 +678,265 @@ void standout_off (void) {
 }
 
 
-/* Depending on the value of io_utf8, this function will do a simple putchar(),
-   or a series of putchar() that expand the given character in UTF-8 encoding. 
-   If attr is -1, no attribute will be set. */
+/* The shadow screen: what we know to be on the terminal, as ne_lines x
+   ne_columns cells. Output is compared with it, and characters that are
+   already on the screen with the same attributes are not output again.
+   Cells covered by the right part of a wide character contain WIDE_CELL,
+   and cells whose content we do not know contain UNKNOWN_CELL. A cleared
+   cell is a space with no attributes.
+
+   While capturing (see begin_repaint()), output goes instead into the
+   target screen, which is then compared with the shadow screen to find the
+   cheapest way to paint it. */
+
+#define UNKNOWN_CELL (-1)
+#define WIDE_CELL (-2)
+/* Set in the attributes of cells output in standout mode. */
+#define STANDOUT_CELL (1U << 31)
+
+typedef struct {
+	int c;
+	uint32_t attr;
+} screen_cell;
+
+static screen_cell *shadow, *target;
+static int shadow_lines, shadow_columns;
+static bool capturing;
+static int capture_y, capture_x;
+
+static int printable(int c, uint32_t * const add_attr);
+
+/* Cursor motions are delayed until something is actually output, so that
+   consecutive motions, or motions over characters that are already on the
+   screen, cost nothing. */
+
+static bool cursor_pending;
+static int pending_y, pending_x;
+
+/* Forgets the content of the screen, adapting the shadow screen to its size. */
+
+static void reset_shadow(void) {
+	if (shadow_lines != ne_lines || shadow_columns != ne_columns) {
+		free(shadow);
+		free(target);
+		shadow = malloc(sizeof *shadow * ne_lines * ne_columns);
+		target = malloc(sizeof *target * ne_lines * ne_columns);
+		if (!shadow || !target) {
+			free(shadow);
+			free(target);
+			shadow = target = NULL;
+		}
+		shadow_lines = ne_lines;
+		shadow_columns = ne_columns;
+	}
+	if (shadow) for(int i = ne_lines * ne_columns; i-- != 0;) shadow[i].c = UNKNOWN_CELL;
+	capturing = false;
+}
+
+/* Returns the given row of the shadow (or, when capturing, target) screen, or
+   NULL if the row is not valid or we have no shadow screen. */
+
+static screen_cell *screen_row(const int y) {
+	if (shadow_lines != ne_lines || shadow_columns != ne_columns) reset_shadow();
+	if (!shadow || y < 0 || y >= shadow_lines) return NULL;
+	return (capturing ? target : shadow) + y * shadow_columns;
+}
+
+static void invalidate_cells(screen_cell * const row, const int x, const int n) {
+	for(int i = 0; i < n; i++) row[x + i].c = UNKNOWN_CELL;
+}
+
+/* Records that the character c, of width w, has been output at column x of
+   row with attributes attr. */
+
+static void put_cell(screen_cell * const row, const int x, const int c, const uint32_t attr, const int w) {
+	if (!row || x < 0) return;
+	if (x + w > shadow_columns) {
+		if (x < shadow_columns) invalidate_cells(row, x, shadow_columns - x);
+		return;
+	}
+
+	/* Overwriting part of a wide character destroys all of it. */
+	if (row[x].c == WIDE_CELL)
+		for(int i = x; i-- != 0;) {
+			const bool head = row[i].c != WIDE_CELL;
+			row[i].c = UNKNOWN_CELL;
+			if (head) break;
+		}
+	for(int i = x + w; i < shadow_columns && row[i].c == WIDE_CELL; i++) row[i].c = UNKNOWN_CELL;
+
+	row[x].c = c;
+	row[x].attr = attr;
+	for(int i = 1; i < w; i++) {
+		row[x + i].c = WIDE_CELL;
+		row[x + i].attr = attr;
+	}
+}
 
-static void out(int c, const uint32_t attr) {
-	uint32_t add_attr = 0;
+/* Returns whether the cells of row starting at x, up to end, are cleared. */
 
-	/* PORTABILITY PROBLEM: this code is responsible for filtering nonprintable
-		characters. On systems with a wider system character set, it could be
-		redefined, for instance, in order to allow characters between 128 and 160 to
-		be printed. Currently, it returns '?' on all control characters (and
-		non-ISO-8859-1 characters, if io_utf8 is false), space on 160, and the
-		obvious capital letter for control characters below 32. */
+static bool cleared_cells(const screen_cell * const row, int x, const int end) {
+	if (!row) return false;
+	for(; x < end; x++) if (row[x].c != ' ' || row[x].attr != 0) return false;
+	return true;
+}
+
+/* Records that the cells of row starting at x have been cleared, if we can
+   be sure of how they look like. */
+
+static void clear_cells(screen_cell * const row, const int x, const int n) {
+	if (!row || x < 0) return;
+	for(int i = x; i < x + n && i < shadow_columns; i++) {
+		row[i].c = curr_attr == 0 && !standout_mode ? ' ' : UNKNOWN_CELL;
+		row[i].attr = 0;
+	}
+	for(int i = x + n; i < shadow_columns && row[i].c == WIDE_CELL; i++) row[i].c = UNKNOWN_CELL;
+}
+
+/* Records that out() has just output c at column x of row. */
+
+static void put_out_cell(screen_cell * const row, const int x, const int c) {
+	uint32_t add_attr;
+	const int d = printable(c, &add_attr);
+	put_cell(row, x, d, curr_attr | (standout_mode ? STANDOUT_CELL : 0), output_width(c));
+}
+
+/* Records that n unknown cells have been inserted at column x of row,
+   shifting right the rest of the row. */
+
+static void insert_cells(screen_cell * const row, const int x, int n) {
+	if (!row || x < 0 || x >= shadow_columns) return;
+	if (n > shadow_columns - x) n = shadow_columns - x;
+	if (row[x].c == WIDE_CELL) put_cell(row, x, UNKNOWN_CELL, 0, 1);
+	memmove(row + x + n, row + x, sizeof *row * (shadow_columns - x - n));
+	invalidate_cells(row, x, n);
+	/* A wide character pushed partially out of the line is lost. */
+	if (row[shadow_columns - 1].c >= 0 && output_width(row[shadow_columns - 1].c) > 1) row[shadow_columns - 1].c = UNKNOWN_CELL;
+}
+
+/* Records that n cells have been deleted at column x of row, shifting left
+   the rest of the row. */
+
+static void delete_cells(screen_cell * const row, const int x, int n) {
+	if (!row || x < 0 || x >= shadow_columns) return;
+	if (n > shadow_columns - x) n = shadow_columns - x;
+	if (row[x].c == WIDE_CELL) put_cell(row, x, UNKNOWN_CELL, 0, 1);
+	memmove(row + x, row + x + n, sizeof *row * (shadow_columns - x - n));
+	invalidate_cells(row, shadow_columns - n, n);
+	for(int i = x; i < shadow_columns && row[i].c == WIDE_CELL; i++) row[i].c = UNKNOWN_CELL;
+}
+
+/* Records that n lines have been inserted at row y (deleted, if n is negative)
+   in the region of the screen ending at row bottom. */
+
+static void scroll_cells(const int y, const int bottom, const int n) {
+	if (!screen_row(y) || capturing) return;
+	const int k = n > 0 ? n : -n;
+	if (k > bottom - y) {
+		invalidate_cells(shadow + y * shadow_columns, 0, (bottom - y + 1) * shadow_columns);
+		return;
+	}
+	if (n > 0) {
+		memmove(shadow + (y + k) * shadow_columns, shadow + y * shadow_columns, sizeof *shadow * (bottom + 1 - y - k) * shadow_columns);
+		invalidate_cells(shadow + y * shadow_columns, 0, k * shadow_columns);
+	}
+	else {
+		memmove(shadow + y * shadow_columns, shadow + (y + k) * shadow_columns, sizeof *shadow * (bottom + 1 - y - k) * shadow_columns);
+		invalidate_cells(shadow + (bottom + 1 - k) * shadow_columns, 0, k * shadow_columns);
+	}
+}
+
+/* Returns the character that out() will actually display in place of c,
+   adding to *add_attr the attributes it will be displayed with.
+
+   PORTABILITY PROBLEM: this code is responsible for filtering nonprintable
+   characters. On systems with a wider system character set, it could be
+   redefined, for instance, in order to allow characters between 128 and 160 to
+   be printed. Currently, it returns '?' on all control characters (and
+   non-ISO-8859-1 characters, if io_utf8 is false), space on 160, and the
+   obvious capital letter for control characters below 32. */
+
+static int printable(int c, uint32_t * const add_attr) {
+	*add_attr = 0;
 
 	if (c >= 127 && c < 160) {
 		c = '?';
-		add_attr = INVERSE;
+		*add_attr = INVERSE;
 	}
 
 	if (c == 160) {
 		c = ' ';
-		add_attr = INVERSE;
+		*add_attr = INVERSE;
 	}
 
 	if (c < ' ') {
 		c += '@';
-		add_attr = INVERSE;
+		*add_attr = INVERSE;
 	}
 
 	if (c > 0xFF && !io_utf8) {
 		c = '?';
-		add_attr = INVERSE;
+		*add_attr = INVERSE;
 	}
 
 	/* If io_utf8 is off, we consider all characters in the range of ISO-8859-x
 	encoding schemes as printable. */
 
-	if (io_utf8 && wcwidth(c) <= 0) {
+	if (io_utf8 && unicode_width(c) <= 0) {
 		c = '?';
-		add_attr = INVERSE;
+		*add_attr = INVERSE;
+	}
+
+	return c;
+}
+
+/* Outputs a character returned by printable(). */
+
+static void emit(const int c) {
+	if (io_utf8 && c >= 0x80) {
+		char t[6];
+		frame_write(t, utf8str(c, t));
 	}
+	else ne_putchar(c);
+}
+
+/* Depending on the value of io_utf8, this function will output a single byte,
+   or the bytes that expand the given character in UTF-8 encoding.
+   If attr is -1, no attribute will be set. */
 
+static void out(const int c, const uint32_t attr) {
+	uint32_t add_attr;
+	const int d = printable(c, &add_attr);
 	if (attr != -1) set_attr(attr | add_attr);
+	emit(d);
+}
 
-	if (io_utf8) {
-		if (c < 0x80) putchar(c); /* ASCII */
-		else if (c < 0x800) {
-			putchar(0xC0 | (c >> 6));
-			putchar(0x80 | (c >> 0) & 0x3F);
-		}
-		else if (c < 0x10000) {
-			putchar(0xE0 | (c >> 12));
-			putchar(0x80 | (c >> 6) & 0x3F);
-			putchar(0x80 | (c >> 0) & 0x3F);
-		}
-		else if (c < 0x200000) {
-			putchar(0xF0 | (c >> 18));
-			putchar(0x80 | (c >> 12) & 0x3F);
-			putchar(0x80 | (c >> 6) & 0x3F);
-			putchar(0x80 | (c >> 0) & 0x3F);
-		}
-		else if (c < 0x4000000) {
-			putchar(0xF8 | (c >> 24));
-			putchar(0x80 | (c >> 18) & 0x3F);
-			putchar(0x80 | (c >> 12) & 0x3F);
-			putchar(0x80 | (c >> 6) & 0x3F);
-			putchar(0x80 | (c >> 0) & 0x3F);
-		}
-		else {
-			putchar(0xFC | (c >> 30));
-			putchar(0x80 | (c >> 24) & 0x3F);
-			putchar(0x80 | (c >> 18) & 0x3F);
-			putchar(0x80 | (c >> 12) & 0x3F);
-			putchar(0x80 | (c >> 6) & 0x3F);
-			putchar(0x80 | (c >> 0) & 0x3F);
-		}
+
+/* Returns the number of bytes needed to move the cursor from column x of
+   row y to column x + n by outputting again the characters that are already
+   there, or -1 if this is not possible (or if it takes limit bytes or more).
+   This is used by cmgoto() to find the cheapest cursor motion. */
+
+int rewrite_cost(const int y, const int x, const int n, const int limit) {
+	if (capturing || insert_mode || curr_attr_unsure || ne_transparent_underline || ne_tilde_glitch || n > limit) return -1;
+	const screen_cell * const row = screen_row(y);
+	if (!row || x < 0 || x + n >= shadow_columns || row[x].c == WIDE_CELL || row[x + n].c == WIDE_CELL) return -1;
+
+	const uint32_t shown = curr_attr | (standout_mode ? STANDOUT_CELL : 0);
+	int cost = 0;
+	for(int i = x; i < x + n; i++) {
+		if (row[i].c == WIDE_CELL) continue;
+		if (row[i].c == UNKNOWN_CELL || row[i].attr != shown) return -1;
+		if ((cost += io_utf8 ? utf8seqlen(row[i].c) : 1) >= limit) return -1;
 	}
-	else putchar(c);
+	return cost;
+}
+
+/* Outputs again the n cells starting at column x of row y (see rewrite_cost()). */
+
+void rewrite(const int y, const int x, const int n) {
+	const screen_cell * const row = screen_row(y);
+	for(int i = x; i < x + n; i++) if (row[i].c != WIDE_CELL) emit(row[i].c);
 }
 
 
@@ -549,10 +1005,14 @@ void set_terminal_modes(void) {
 	OUTPUT1_IF(ne_exit_standout_mode);
 	OUTPUT1_IF(ne_enter_ca_mode);
 	OUTPUT1_IF(ne_keypad_xmit);
+	OUTPUT1_IF(ne_bracketed_paste_on);
 
 	if (ne_has_meta_key) OUTPUT1_IF(ne_meta_on);
    turn_off_standout();
 	losecursor();
+	/* The content of the screen may have changed (e.g., because of ca mode). */
+	cursor_pending = false;
+	reset_shadow();
 }
 
 
@@ -560,11 +1020,14 @@ void set_terminal_modes(void) {
 
 void reset_terminal_modes (void) {
 
+	sync_cursor();
 	OUTPUT1_IF(ne_exit_attribute_mode);
 	OUTPUT1_IF(ne_exit_alt_charset_mode);
 	turn_off_standout();
+	OUTPUT1_IF(ne_bracketed_paste_off);
 	OUTPUT1_IF(ne_keypad_local);
 	OUTPUT1_IF(ne_exit_ca_mode);
+	reset_shadow();
 }
 
 
@@ -590,13 +1053,39 @@ void cursor_off (void) {
 }
 
 
-/* Move to absolute position, specified origin 0 */
+/* The cursor position as seen by the higher levels. */
 
-void move_cursor (const int row, const int col) {
-	if (curY == row && curX == col) return;
+static int cursor_y(void) {
+	return capturing ? capture_y : cursor_pending ? pending_y : curY;
+}
+
+static int cursor_x(void) {
+	return capturing ? capture_x : cursor_pending ? pending_x : curX;
+}
+
+/* Performs the pending cursor motion, if any. */
+
+static void sync_cursor(void) {
+	if (!cursor_pending) return;
+	cursor_pending = false;
+	if (curY == pending_y && curX == pending_x) return;
 	if (!ne_move_standout_mode) turn_off_standout();
 	if (!ne_move_insert_mode) turn_off_insert ();
-	cmgoto (row, col);
+	cmgoto (pending_y, pending_x);
+}
+
+
+/* Move to absolute position, specified origin 0 */
+
+void move_cursor (const int row, const int col) {
+	if (capturing) {
+		capture_y = row;
+		capture_x = col;
+		return;
+	}
+	cursor_pending = true;
+	pending_y = row;
+	pending_x = col;
 }
 
 
@@ -605,14 +1094,28 @@ void move_cursor (const int row, const int col) {
    may be moved, on terminals lacking a `ce' string.  */
 
 void clear_end_of_line(const int first_unused_hpos) {
-	if (curX >= first_unused_hpos) return;
+	const int x = cursor_x();
+	if (x >= first_unused_hpos) return;
+
+	screen_cell * const row = screen_row(cursor_y());
+	if (capturing) {
+		if (row) for(int i = x; i < shadow_columns; i++) row[i] = (screen_cell){ ' ', 0 };
+		return;
+	}
+	/* Nothing to do if the line is already clear. */
+	if (cleared_cells(row, x, first_unused_hpos < shadow_columns ? first_unused_hpos : shadow_columns)) return;
 
+	sync_cursor();
 	if (curr_attr & BG_NOT_DEFAULT) set_attr(0);
-	if (ne_clr_eol) OUTPUT1 (ne_clr_eol);
+	if (ne_clr_eol) {
+		OUTPUT1 (ne_clr_eol);
+		clear_cells(row, x, shadow_columns - x);
+	}
 	else {
 		/* We have to do it the hard way. */
 		turn_off_insert ();
-		for (int i = curX; i < first_unused_hpos; i++) putchar (' ');
+		for (int i = curX; i < first_unused_hpos; i++) ne_putchar(' ');
+		clear_cells(row, x, first_unused_hpos - x);
 		cmplus (first_unused_hpos - curX);
 	}
 }
@@ -630,9 +1133,14 @@ void clear_to_eol(void) {
 
 void clear_to_end (void) {
 
-	if (ne_clr_eos) OUTPUT(ne_clr_eos);
+	if (ne_clr_eos) {
+		sync_cursor();
+		OUTPUT(ne_clr_eos);
+		clear_cells(screen_row(curY), curX, shadow_columns - curX);
+		for (int i = curY + 1; i < ne_lines; i++) clear_cells(screen_row(i), 0, shadow_columns);
+	}
 	else {
-		for (int i = curY; i < ne_lines; i++) {
+		for (int i = cursor_y(); i < ne_lines; i++) {
 			move_cursor (i, 0);
 			clear_to_eol();
 		}
@@ -645,8 +1153,10 @@ void clear_to_end (void) {
 void clear_entire_screen (void) {
 
 	if (ne_clear_screen) {
+		cursor_pending = false;
 		OUTPUTL(ne_clear_screen, ne_lines);
 		cmat (0, 0);
+		for (int i = 0; i < ne_lines; i++) clear_cells(screen_row(i), 0, shadow_columns);
 	}
 	else {
 		move_cursor (0, 0);
@@ -665,9 +1175,6 @@ void clear_entire_screen (void) {
 void output_chars(const char *string, const uint32_t *attr, const int raw_len, const bool utf8) {
 	if (raw_len == 0) return;
 
-	turn_off_insert();
-	standout_if_wanted();
-
 	/* If the string is UTF-8 encoded, compute its real length. */
 	int len = utf8 && string != NULL ? utf8strlen(string, raw_len) : raw_len;
 
@@ -675,48 +1182,164 @@ void output_chars(const char *string, const uint32_t *attr, const int raw_len, c
 		len. Moreover, we don't dare write in last column of bottom line, if
 		AutoWrap, since that would scroll the whole screen on some terminals. */
 
-	cmplus(string_output_width(string, &len, ne_columns - curX - (AutoWrap && curY == ne_lines - 1), utf8));
-
-	if (string == NULL) {
-		for(int i = 0; i < len; i++) {
-			/* When outputting spaces, it's only the first attribute that's used. */
-			if (attr) set_attr(*attr);
-			putchar(' ');
-		}
-		return;
-	}
+	const int y = cursor_y();
+	int x = cursor_x();
+	string_output_width(string, &len, ne_columns - x - (AutoWrap && y == ne_lines - 1), utf8);
+	screen_cell * const row = screen_row(y);
 
-	if (!ne_transparent_underline && !ne_tilde_glitch) {
-		for(int i = 0; i < len; i++) {
-			if (utf8) {
-				const int c = utf8char(string);
-				string += utf8len(*string);
-				out(c, attr ? attr[i] : -1);
-			}
-			else {
-				const int c = (unsigned char)*string++;
-				out(c, attr ? attr[i] : -1);
-			}
-		}
-	} 
-	else
+	if (ne_transparent_underline || ne_tilde_glitch) {
+		/* We do not try to optimize such terminals. */
+		sync_cursor();
+		turn_off_insert();
+		standout_if_wanted();
 		for(int i = 0; i < len; i++) {
-			if (attr) set_attr(attr[i]);
-			int c = utf8 ? utf8char(string) : (unsigned char)*string;
+			int c = string == NULL ? ' ' : utf8 ? utf8char(string) : (unsigned char)*string;
+			const int w = output_width(c);
+			if (attr) set_attr(string == NULL ? *attr : attr[i]);
 
 			if (c == '_' && ne_transparent_underline) {
-				putchar (' ');
+				ne_putchar(' ');
 				OUTPUT1(Left);
 			}
 
 			if (ne_tilde_glitch && c == '~') c = '`';
 
-			out(c, attr ? attr[i] : -1);
+			out(c, attr ? string == NULL ? *attr : attr[i] : -1);
+			if (row) invalidate_cells(row, x, x + w <= shadow_columns ? w : shadow_columns - x);
+			cmplus(w);
+			x += w;
+			if (string) string += utf8 ? utf8len(*string) : 1;
+		}
+		return;
+	}
+
+	for(int i = 0; i < len; i++) {
+		int c;
+		uint32_t a, add_attr;
+		if (string == NULL) {
+			/* When outputting spaces, it's only the first attribute that's used. */
+			c = ' ';
+			a = attr ? *attr : -1;
+		}
+		else {
+			c = utf8 ? utf8char(string) : (unsigned char)*string;
 			string += utf8 ? utf8len(*string) : 1;
+			a = attr ? attr[i] : -1;
 		}
+		const int d = printable(c, &add_attr), w = output_width(c);
+		const uint32_t shown = (a != -1 ? a | add_attr : curr_attr) | (standout_wanted ? STANDOUT_CELL : 0);
+
+		if (capturing) put_cell(row, x, d, shown, w);
+		/* Characters that are already on the screen are skipped, except in
+		   the last column, where the cursor motion is more delicate. */
+		else if (!row || x + w >= shadow_columns || row[x].c != d || row[x].attr != shown) {
+			sync_cursor();
+			turn_off_insert();
+			standout_if_wanted();
+			if (a != -1) set_attr(a | add_attr);
+			emit(d);
+			put_cell(row, x, d, curr_attr | (standout_mode ? STANDOUT_CELL : 0), w);
+			cmplus(w);
+		}
+		else move_cursor(y, x + w);
+		x += w;
+	}
+
+	if (capturing) capture_x = x;
+}
+
+
+
+/* Helper for output_run(): copies the len bytes of the given characters,
+   which must be output verbatim, to the output frame at column x of line
+   y, and records them in the shadow screen. */
+
+static void flush_run(const char *s, const int len, int x, const int y, const uint32_t attr, const bool utf8) {
+	screen_cell * const row = screen_row(y);
+	move_cursor(y, x);
+	sync_cursor();
+	turn_off_insert();
+	standout_if_wanted();
+	if (attr != -1) set_attr(attr);
+	frame_write(s, len);
+
+	const int x0 = x;
+	const uint32_t shown = curr_attr | (standout_mode ? STANDOUT_CELL : 0);
+	for(const char * const end = s + len; s < end; ) {
+		const int c = utf8 ? utf8char(s) : (unsigned char)*s;
+		const int w = verbatim_width(c, utf8);
+		put_cell(row, x, c, shown, w);
+		x += w;
+		s += utf8 ? utf8len(*s) : 1;
+	}
+	cmplus(x - x0);
 }
 
 
+/* Outputs, with attribute attr (no attribute is set if attr == -1), the
+   longest prefix of the raw_len bytes pointed at by string that contains at
+   most *n characters and whose width is at most *width (and fits the current
+   line). Returns the number of bytes output, and stores in *n and *width the
+   number of characters and the width of the prefix. If utf8 is true, the
+   string is UTF-8 encoded.
+
+   Changed characters that out() would output unmodified are copied directly
+   from string into the output frame. */
+
+int output_run(const char *string, const uint32_t attr, const int raw_len, int * const n, int * const width, const bool utf8) {
+	const char * const start = string, * const end = string + raw_len;
+	const int y = cursor_y(), x0 = cursor_x();
+	int max_x = ne_columns - (AutoWrap && y == ne_lines - 1);
+	if (max_x > x0 + *width) max_x = x0 + *width;
+	screen_cell * const row = screen_row(y);
+	const bool verbatim_ok = !ne_transparent_underline && !ne_tilde_glitch;
+	const char *run = NULL;
+	int x = x0, run_x = 0, count = 0;
+
+	while(string < end && count < *n) {
+		const int c = utf8 ? utf8char(string) : (unsigned char)*string;
+		const int len = utf8 ? utf8len(*string) : 1;
+		int w = verbatim_ok ? verbatim_width(c, utf8) : 0;
+		const bool verbatim = w != 0;
+		if (!verbatim) w = output_width(c);
+		if (x + w > max_x) break;
+
+		if (capturing) {
+			uint32_t add_attr;
+			const int d = printable(c, &add_attr);
+			put_cell(row, x, d, (attr != -1 ? attr | add_attr : curr_attr) | (standout_wanted ? STANDOUT_CELL : 0), w);
+		}
+		else if (verbatim) {
+			const uint32_t shown = (attr != -1 ? attr : curr_attr) | (standout_wanted ? STANDOUT_CELL : 0);
+			if (row && x + w < shadow_columns && row[x].c == c && row[x].attr == shown) {
+				/* Already on the screen: we end the current run. */
+				if (run) flush_run(run, string - run, run_x, y, attr, utf8);
+				run = NULL;
+			}
+			else if (!run) {
+				run = string;
+				run_x = x;
+			}
+		}
+		else {
+			if (run) flush_run(run, string - run, run_x, y, attr, utf8);
+			run = NULL;
+			move_cursor(y, x);
+			output_chars(string, attr != -1 ? &attr : NULL, len, utf8);
+		}
+
+		string += len;
+		x += w;
+		count++;
+	}
+
+	if (run) flush_run(run, string - run, run_x, y, attr, utf8);
+	move_cursor(y, x);
+	*n = count;
+	*width = x - x0;
+	return string - start;
+}
+
 
 /* Outputs a NULL-terminated string without setting attributes. */
 
@@ -758,10 +1381,12 @@ void output_spaces(const int n, const uint32_t * const attr) {
 void insert_chars(const char * start, const uint32_t * const attr, const int raw_len, const bool utf8) {
 	if (raw_len == 0) return;
 
+	sync_cursor();
 	standout_if_wanted();
 
 	/* If the string is non-NULL and UTF-8 encoded, compute its real length. */
 	int len = utf8 && start != NULL ? utf8strlen(start, raw_len) : raw_len;
+	screen_cell * const row = screen_row(curY);
 
 	if (ne_parm_ich) {
 		int width = 0;
@@ -774,6 +1399,7 @@ void insert_chars(const char * start, const uint32_t * const attr, const int raw
 
 		const char * const buf = tparm (ne_parm_ich, width);
 		OUTPUT1 (buf);
+		insert_cells(row, curX, width);
 
 		if (start) output_chars(start, attr, raw_len, utf8);
 
@@ -787,7 +1413,10 @@ void insert_chars(const char * start, const uint32_t * const attr, const int raw
 		bottom line, if AutoWrap, since that would scroll the whole screen
 		on some terminals. */
 
-	cmplus(string_output_width(start, &len, ne_columns - curX - (AutoWrap && curY == ne_lines - 1), utf8));
+	int x = curX;
+	const int width = string_output_width(start, &len, ne_columns - curX - (AutoWrap && curY == ne_lines - 1), utf8);
+	cmplus(width);
+	insert_cells(row, x, width);
 
 	if (!ne_transparent_underline && !ne_tilde_glitch && start
 		  && ne_insert_padding == NULL && ne_insert_character == NULL) {
@@ -800,6 +1429,8 @@ void insert_chars(const char * start, const uint32_t * const attr, const int raw
 			}
 			else c = (unsigned char)*start++;
 			out(c, attr ? attr[i] : -1);
+			put_out_cell(row, x, c);
+			x += output_width(c);
 		}
 	}
 	else
@@ -810,6 +1441,7 @@ void insert_chars(const char * start, const uint32_t * const attr, const int raw
 			if (!start) {
 				/* When outputting spaces, it's only the first attribute that's used. */
 				out(' ', attr ? *attr : -1);
+				put_out_cell(row, x++, ' ');
 			}
 			else {
 				if (attr) set_attr(attr[i]);
@@ -823,6 +1455,8 @@ void insert_chars(const char * start, const uint32_t * const attr, const int raw
 				if (ne_tilde_glitch && c == '~') c = '`';
 
 				out(c, attr ? attr[i] : -1);
+				put_out_cell(row, x, c);
+				x += output_width(c);
 			}
 
 			OUTPUT1_IF(ne_insert_padding);
@@ -854,6 +1488,8 @@ void insert_char(const int c, const uint32_t attr, const bool utf8) {
 void delete_chars (int n) {
 	if (n == 0) return;
 
+	sync_cursor();
+	delete_cells(screen_row(curY), curX, n);
 	standout_if_wanted();
 	if (delete_in_insert_mode) turn_on_insert();
 	else {
@@ -876,6 +1512,7 @@ for n lines, given a parametrized and/or a one-line capability
 for that purpose. */
 
 static void do_multi_ins_del(char * const multi, const char * const single, int n) {
+	sync_cursor();
 	if (multi) {
 		const char * const buf = tparm(multi, n);
 		OUTPUT(buf);
@@ -900,6 +1537,7 @@ int ins_del_lines (const int vpos, const int n) {
 
 	if (!ne_memory_below && vpos + i >= ne_lines) return false;
 
+	scroll_cells(vpos, specified_window - 1, n);
 	standout_if_wanted();
 
 	if (scroll_region_ok) {
@@ -907,10 +1545,12 @@ int ins_del_lines (const int vpos, const int n) {
 
 		if (n < 0) {
 			move_cursor(specified_window - 1, 0);
+			sync_cursor();
 			while (i-- != 0) OUTPUTL(ne_scroll_forward, specified_window - vpos + 1);
 		}
 		else {
 			move_cursor(vpos, 0);
+			sync_cursor();
 			while (i-- != 0) OUTPUTL(ne_scroll_reverse, specified_window - vpos + 1);
 		}
 
@@ -945,6 +1585,118 @@ int ins_del_lines (const int vpos, const int n) {
 }
 
 
+/* Returns a hash of the given row of a screen, or 0 if the row is blank or
+   contains unknown cells (so that it will not be matched against anything). */
+
+static uint32_t hash_row(const screen_cell * const row) {
+	uint32_t h = 0;
+	bool blank = true;
+	for(int x = 0; x < shadow_columns; x++) {
+		if (row[x].c == UNKNOWN_CELL) return 0;
+		if (row[x].c != ' ' || row[x].attr != 0) blank = false;
+		h = (h ^ row[x].c ^ row[x].attr * 0x9E3779B1U) * 0x01000193U;
+	}
+	return blank || h == 0 ? 0 : h;
+}
+
+
+/* Starts a full repaint of some lines. Until end_repaint() is called, output
+   does not go to the terminal, but into a target screen, initialized from
+   the shadow screen. end_repaint() will then bring the terminal to show the
+   target screen. */
+
+void begin_repaint(void) {
+	if (ne_transparent_underline || ne_tilde_glitch || !screen_row(0)) return;
+	memcpy(target, shadow, sizeof *shadow * shadow_lines * shadow_columns);
+	capture_y = cursor_y();
+	capture_x = cursor_x();
+	capturing = true;
+}
+
+
+/* Ends a full repaint of lines first to last started by begin_repaint(). If
+   the new content of the lines is the old one shifted by some lines, we
+   scroll it in place first; then, we output only the cells that differ. */
+
+void end_repaint(const int first, int last) {
+	if (!capturing) return;
+	capturing = false;
+	if (last >= shadow_lines) last = shadow_lines - 1;
+
+	if (line_ins_del_ok && last - first >= 2) {
+		uint32_t * const old_hash = malloc(sizeof *old_hash * 2 * (last - first + 1)), * const new_hash = old_hash + (last - first + 1);
+		if (old_hash) {
+			for(int y = first; y <= last; y++) {
+				old_hash[y - first] = hash_row(shadow + y * shadow_columns);
+				new_hash[y - first] = hash_row(target + y * shadow_columns);
+			}
+
+			/* We look for the shift s such that new line y is old line y - s
+				for the largest number of lines. */
+			int best_shift = 0, best = -1, identity = 0;
+			for(int s = -(last - first - 1); s <= last - first - 1; s++) {
+				int matches = 0;
+				for(int y = first + (s > 0 ? s : 0); y <= last + (s < 0 ? s : 0); y++)
+					if (new_hash[y - first] != 0 && new_hash[y - first] == old_hash[y - s - first]
+						&& !memcmp(target + y * shadow_columns, shadow + (y - s) * shadow_columns, sizeof *target * shadow_columns)) matches++;
+				if (s == 0) identity = matches;
+				if (matches > best) {
+					best = matches;
+					best_shift = s;
+				}
+			}
+			free(old_hash);
+
+			if (best_shift != 0 && best >= identity + 2) {
+				const int saved_window = specified_window;
+				specified_window = last + 1;
+				ins_del_lines(first, best_shift);
+				specified_window = saved_window;
+			}
+		}
+	}
+
+	const bool saved_standout = standout_wanted;
+	for(int y = first; y <= last; y++) {
+		const screen_cell * const row = target + y * shadow_columns;
+		int end = shadow_columns;
+		while(end > 0 && row[end - 1].c == ' ' && row[end - 1].attr == 0) end--;
+
+		for(int x = 0; x < end; ) {
+			if (row[x].c < 0) {
+				x++;
+				continue;
+			}
+
+			/* We encode a run of cells with the same attributes and pass it
+				to output_run(), which will skip the unchanged ones. */
+			char buffer[64 * 6];
+			int len = 0, next = x;
+			while(next < end && len < sizeof buffer - 6 && (row[next].c == WIDE_CELL || row[next].c >= 0 && row[next].attr == row[x].attr)) {
+				if (row[next].c >= 0) {
+					if (io_utf8) len += utf8str(row[next].c, buffer + len);
+					else buffer[len++] = row[next].c;
+				}
+				next++;
+			}
+
+			if (row[x].attr & STANDOUT_CELL) standout_on();
+			else standout_off();
+			move_cursor(y, x);
+			int n = INT_MAX, width = next - x;
+			output_run(buffer, row[x].attr & ~STANDOUT_CELL, len, &n, &width, io_utf8);
+			x = next;
+		}
+		move_cursor(y, end);
+		clear_to_eol();
+	}
+
+	if (saved_standout) standout_on();
+	else standout_off();
+	move_cursor(capture_y, capture_x);
+}
+
+
 extern int cost;		/* In cm.c */
 extern int evalcost(int);
 
@@ -1038,6 +1790,11 @@ void copy_caps(void) {
 	ne_cursor_left = cursor_left;
 	ne_cursor_up = cursor_up;
 
+	ne_parm_right_cursor = parm_right_cursor;
+	ne_parm_down_cursor = parm_down_cursor;
+	ne_parm_left_cursor = parm_left_cursor;
+	ne_parm_up_cursor = parm_up_cursor;
+
 	ne_auto_right_margin = auto_right_margin;
 	ne_eat_newline_glitch = eat_newline_glitch;
 
@@ -1150,7 +1907,35 @@ void term_init (void) {
 		exit(1);
 	}
 #ifndef TERMCAP
-	else copy_caps();
+	else {
+		copy_caps();
+
+		/* Synchronized output is advertised by the extended capability Sync,
+		   whose parameter is 1 to begin an update and 2 to end it. */
+		char * const sync = tigetstr("Sync");
+		if (sync && sync != (char *)-1) {
+			char * const begin = strdup(tparm(sync, 1));
+			sync_end = strdup(tparm(sync, 2));
+			if (begin && sync_end && (frame_start = strlen(begin)) + (sync_end_len = strlen(sync_end)) < frame_size / 2) memcpy(frame, begin, frame_len = frame_start);
+			else {
+				free(sync_end);
+				sync_end = NULL;
+				frame_start = sync_end_len = 0;
+			}
+			free(begin);
+		}
+
+		/* Bracketed paste is advertised by the extended capabilities BE and BD,
+		   which enable and disable it, and PS and PE, which the terminal sends
+		   around pasted text. */
+		char * const be = tigetstr("BE"), * const bd = tigetstr("BD"), * const ps = tigetstr("PS"), * const pe = tigetstr("PE");
+		if (be && be != (char *)-1 && bd && bd != (char *)-1 && ps && ps != (char *)-1 && pe && pe != (char *)-1 && *ps && *pe) {
+			ne_bracketed_paste_on = be;
+			ne_bracketed_paste_off = bd;
+			ne_paste_start = ps;
+			ne_paste_end = pe;
+		}
+	}
 #endif
 
 	ColPosition = ne_column_address;
@@ -1163,6 +1948,10 @@ void term_init (void) {
 	Down = ne_cursor_down;
 	Left = ne_cursor_left;
 	Up = ne_cursor_up;
+	MultiRight = ne_parm_right_cursor;
+	MultiDown = ne_parm_down_cursor;
+	MultiLeft = ne_parm_left_cursor;
+	MultiUp = ne_parm_up_cursor;
 	AutoWrap = ne_auto_right_margin;
 	MagicWrap = ne_eat_newline_glitch;
 	ScreenRows = ne_lines;
@@ -1234,4 +2023,29 @@ void term_init (void) {
 	cursor_on_off_ok = (ne_cursor_invisible && ne_cursor_normal);
 
 	color_ok = (ne_set_foreground && ne_set_background);
+
+#ifndef PLAIN_SET_ATTR
+	/* We can build attribute changes by ourselves if all attributes, and colors, are
+		set by single, standard SGR sequences. */
+	static const struct { char **cap; const char *sgr; } modes[] = {
+		{ &ne_enter_reverse_mode, "\033[7m" },
+		{ &ne_enter_bold_mode, "\033[1m" },
+		{ &ne_enter_underline_mode, "\033[4m" },
+		{ &ne_enter_dim_mode, "\033[2m" },
+		{ &ne_enter_blink_mode, "\033[5m" },
+	};
+
+	const char * const sgr0 = sgr_suffix(ne_exit_attribute_mode);
+	ecma48_sgr = sgr0 && (!strcmp(sgr0, "\033[m") || !strcmp(sgr0, "\033[0m"));
+	for(int i = 0; i < sizeof modes / sizeof *modes; i++)
+		if (*modes[i].cap && strcmp(*modes[i].cap, modes[i].sgr)) ecma48_sgr = false;
+	if (ecma48_sgr && color_ok) {
+		for(int i = 0; i < 8; i++) {
+			const char *buf = tparm(ne_set_foreground, i);
+			if (!buf || sgr_suffix(buf) != buf) ecma48_sgr = false;
+			buf = tparm(ne_set_background, i);
+			if (!buf || sgr_suffix(buf) != buf) ecma48_sgr = false;
+		}
+	}
+#endif
 }
@@ -21,6 +21,12 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+int ne_putchar(int c);
+void flush_frame(void);
+uint64_t output_count(void);
+bool link_estimate(double *bandwidth, double *latency);
+int rewrite_cost(int y, int x, int n, int limit);
+void rewrite(int y, int x, int n);
 int output_width(int c);
 void ring_bell(void);
 void do_flash(void);
@@ -38,6 +44,7 @@ void clear_to_end(void);
 void clear_entire_screen(void);
 void set_attr(const uint32_t);
 void output_chars(const char *string, const uint32_t *attr, int raw_len, bool utf8);
+int output_run(const char *string, uint32_t attr, int raw_len, int *n, int *width, bool utf8);
 void output_string(const char *s, bool utf8);
 void output_spaces(int n, const uint32_t *attr);
 void output_char(int c, const uint32_t attr, const bool utf8);
@@ -45,5 +52,7 @@ void insert_chars(const char *start, const uint32_t *attr, int raw_len, bool utf
 void insert_char(int c, const uint32_t attr, bool utf8);
 void delete_chars(int n);
 int ins_del_lines(int vpos, int n);
+void begin_repaint(void);
+void end_repaint(int first, int last);
 int ttysize(void);
 void term_init(void);
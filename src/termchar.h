@@ -121,6 +121,11 @@ extern char *ne_cursor_down;
 extern char *ne_cursor_left;
 extern char *ne_cursor_up;
 
+extern char *ne_parm_right_cursor;
+extern char *ne_parm_down_cursor;
+extern char *ne_parm_left_cursor;
+extern char *ne_parm_up_cursor;
+
 extern int ne_auto_right_margin;
 extern int ne_eat_newline_glitch;
 
@@ -191,6 +196,11 @@ extern char *ne_set_window;
 extern char *ne_keypad_local;
 extern char *ne_keypad_xmit;
 
+extern char *ne_bracketed_paste_on;
+extern char *ne_bracketed_paste_off;
+extern char *ne_paste_start;
+extern char *ne_paste_end;
+
 extern char *ne_clr_eol;
 extern bool ne_transparent_underline;
 
@@ -18,6 +18,9 @@
    You should have received a copy of the GNU General Public License
    along with this program; if not, see <http://www.gnu.org/licenses/>.  */
 
+#ifndef _NE_UTF8_H
+#define _NE_UTF8_H 1
+
 #include <stdint.h>
 
 int utf8char(const char *s);
@@ -38,11 +41,25 @@ int utf8toupper(int c);
 	 ((unsigned char)(c)) < 0xF8 ?  4 : \
 	 ((unsigned char)(c)) < 0xFC ?  5 : 6)
 
-#ifdef NOWCHAR
-#define wcwidth(x) (1)
-#else
+#ifndef NOWCHAR
 #include <wchar.h>
 #include <wctype.h>
 #endif
 
+/* The two-level table of character widths generated by width.pl. */
+
+extern const unsigned char unicode_width_index[], unicode_width_block[][64];
+
+/* Returns the number of columns occupied on a terminal by the given Unicode
+   character, with the same conventions as wcwidth(): 0 for combining and
+   format characters, -1 for nonprintable characters. Contrarily to wcwidth(),
+   the result does not depend on the C library or on the locale. */
+
+static inline int unicode_width(const int c) {
+	if (c < 0 || c > 0x10FFFF) return -1;
+	return (unicode_width_block[unicode_width_index[c >> 8]][(c & 0xFF) >> 2] >> ((c & 3) << 1) & 3) - 1;
+}
+
 #define MAX_UTF_8 (0x7FFFFFFF)
+
+#endif
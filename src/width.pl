@@ -0,0 +1,156 @@
+#!/usr/bin/perl -w
+
+use strict;
+use Unicode::UCD qw(prop_invlist prop_invmap);
+
+# This program creates width.c, which contains the table used by
+# unicode_width() (see utf8.h) to compute the number of columns occupied by
+# a Unicode character on a terminal. The data comes from the Unicode
+# Character Database distributed with Perl, so the result does not depend
+# on the C library or on the locale. The rules are those of Markus Kuhn's
+# wcwidth():
+#
+# - control characters, line and paragraph separators, surrogates and
+#   unassigned code points are not printable (-1), except for NUL, which has
+#   width 0;
+# - nonspacing and enclosing marks, format characters (except for the soft
+#   hyphen and the prepended concatenation marks) and Hangul medial vowels
+#   and final consonants have width 0;
+# - East Asian Wide and Fullwidth characters (including the unassigned code
+#   points of the ideographic planes) have width 2;
+# - all other characters have width 1.
+#
+# Widths are stored in two bits each (as width + 1). The code points are
+# divided in blocks of 256; the first-level table maps each block to one of
+# the distinct second-level blocks of 64 bytes.
+
+my $width_c_fname = "width.c";
+
+my $copyright =
+  qq[	Copyright (C) 1993-1998 Sebastiano Vigna
+	Copyright (C) 1999-2017 Todd M. Lewis and Sebastiano Vigna
+
+	This file is part of ne, the nice editor.
+
+	This library is free software; you can redistribute it and/or modify it
+	under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 3 of the License, or (at your
+	option) any later version.
+
+	This library is distributed in the hope that it will be useful, but
+	WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+	or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+	for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program; if not, see <http://www.gnu.org/licenses/>.];
+
+my $max_code_point = 0x10FFFF;
+
+# Expands an inversion map into an array indexed by code point.
+
+sub expand
+  {
+    my ( $prop ) = @_;
+    my ( $list, $map ) = prop_invmap( $prop );
+    die "Can't read property $prop from the Unicode Character Database." unless $list;
+    my @value;
+    for my $i ( 0 .. $#$list )
+      {
+        my $end = $i < $#$list ? $list->[$i + 1] - 1 : $max_code_point;
+        @value[ $list->[$i] .. $end ] = ( $map->[$i] ) x ( $end - $list->[$i] + 1 );
+      }
+    return @value;
+  }
+
+my @gc  = expand( "General_Category" );
+my @eaw = expand( "East_Asian_Width" );
+
+# Prepended concatenation marks (e.g., U+0600 ARABIC NUMBER SIGN) are
+# format characters with a visible glyph.
+
+my %pcm;
+my @pcm_list = prop_invlist( "Prepended_Concatenation_Mark" );
+for ( my $i = 0; $i < @pcm_list; $i += 2 )
+  {
+    $pcm{$_} = 1 for $pcm_list[$i] .. ( $i < $#pcm_list ? $pcm_list[$i + 1] - 1 : $max_code_point );
+  }
+
+my @width;
+for my $c ( 0 .. $max_code_point )
+  {
+    my $gc = $gc[$c];
+    if    ( $c == 0 )                                      { $width[$c] = 0  }
+    elsif ( $gc eq "Cc" || $gc eq "Cs" )                   { $width[$c] = -1 }
+    elsif ( $gc eq "Zl" || $gc eq "Zp" )                   { $width[$c] = -1 }
+    elsif ( $gc eq "Cn" && $eaw[$c] ne "W" )               { $width[$c] = -1 }
+    elsif ( $gc eq "Mn" || $gc eq "Me" )                   { $width[$c] = 0  }
+    elsif ( $gc eq "Cf" && $c != 0xAD && ! $pcm{$c} )      { $width[$c] = 0  }
+    elsif ( $c >= 0x1160 && $c <= 0x11FF )                 { $width[$c] = 0  }
+    elsif ( $c >= 0xD7B0 && $c <= 0xD7FF )                 { $width[$c] = 0  }
+    elsif ( $eaw[$c] eq "W" || $eaw[$c] eq "F" )           { $width[$c] = 2  }
+    else                                                   { $width[$c] = 1  }
+  }
+
+# Packs the widths and removes duplicate blocks.
+
+my ( @index, @blocks, %block_number );
+for ( my $start = 0; $start <= $max_code_point; $start += 256 )
+  {
+    my $block = "";
+    for ( my $c = $start; $c < $start + 256; $c += 4 )
+      {
+        my $byte = 0;
+        $byte |= ( $width[$c + $_] + 1 ) << ( 2 * $_ ) for 0 .. 3;
+        $block .= chr $byte;
+      }
+    unless ( exists $block_number{$block} )
+      {
+        $block_number{$block} = scalar @blocks;
+        push @blocks, $block;
+      }
+    push @index, $block_number{$block};
+  }
+
+die "Too many distinct blocks (" . scalar @blocks . ")." if @blocks > 256;
+
+open WIDTH_C, ">$width_c_fname" or die("Couldn't write $width_c_fname");
+
+print WIDTH_C qq[/* Unicode character widths (Unicode ] . Unicode::UCD::UnicodeVersion() . qq[).
+
+	This file has been generated automatically by width.pl: do not edit it.
+
+$copyright  */
+
+
+/* The block of 256 code points containing c is unicode_width_block[unicode_width_index[c >> 8]];
+   the width of c, plus one, is stored in bits 2 * (c & 3) and 2 * (c & 3) + 1 of byte (c & 0xFF) >> 2
+   of the block. */
+
+const unsigned char unicode_width_index[] = {
+];
+
+for ( my $i = 0; $i < @index; $i += 16 )
+  {
+    my $end = $i + 15 < $#index ? $i + 15 : $#index;
+    print WIDTH_C "\t", join( ", ", @index[ $i .. $end ] ), $end < $#index ? ",\n" : "\n";
+  }
+
+print WIDTH_C "};\n\nconst unsigned char unicode_width_block[][64] = {\n";
+
+for my $b ( 0 .. $#blocks )
+  {
+    my @bytes = map { sprintf "0x%02X", ord } split //, $blocks[$b];
+    print WIDTH_C "\t{ /* ", $b, " */\n";
+    for ( my $i = 0; $i < 64; $i += 16 )
+      {
+        print WIDTH_C "\t\t", join( ", ", @bytes[ $i .. $i + 15 ] ), $i < 48 ? ",\n" : "\n";
+      }
+    print WIDTH_C "\t}", $b < $#blocks ? ",\n" : "\n";
+  }
+
+print WIDTH_C "};\n";
+
+close WIDTH_C;
+
+print scalar @blocks, " distinct blocks of widths written to $width_c_fname.\n";
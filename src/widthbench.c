@@ -0,0 +1,135 @@
+/* Character width benchmark.
+
+   Copyright (C) 1993-1998 Sebastiano Vigna
+   Copyright (C) 1999-2017 Todd M. Lewis and Sebastiano Vigna
+
+   This file is part of ne, the nice editor.
+
+   This library is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or (at your
+   option) any later version.
+
+   This library is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+   or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+   for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.  */
+
+
+#include <locale.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <wchar.h>
+#include "utf8.h"
+
+/* This program measures the cost per character of the C library wcwidth()
+   and of unicode_width(), the table lookup ne uses in its place, on a few
+   sets of code points: printable ASCII, Latin (U+00A0-U+024F), CJK unified
+   ideographs, and random code points of the Basic Multilingual Plane and of
+   the whole Unicode range.
+
+   Usage: widthbench [-t seconds] [locale]
+
+   wcwidth() is called in the given locale (default "C.UTF-8"). Each set is
+   scanned repeatedly for at least the given number of seconds (default 0.2)
+   by each function.
+
+   The output is a tab-separated table, with a header line starting with
+   '#' and a line per set: number of code points, nanoseconds per character
+   for wcwidth() and unicode_width(), their ratio, and the number of code
+   points on which the two functions disagree. */
+
+#define SET_SIZE (1 << 16)
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1E9;
+}
+
+/* A xorshift generator with a fixed seed, so that runs are comparable. */
+
+static uint64_t seed = 0x9E3779B97F4A7C15ULL;
+
+static unsigned rnd(const unsigned n) {
+	seed ^= seed << 13;
+	seed ^= seed >> 7;
+	seed ^= seed << 17;
+	return seed % n;
+}
+
+static int lib_width(const int c) {
+	return wcwidth(c);
+}
+
+static int table_width(const int c) {
+	return unicode_width(c);
+}
+
+/* Keeps the compiler from optimising the computation away. */
+
+static volatile int sink;
+
+/* Returns the number of nanoseconds per character taken by width() on set. */
+
+static double measure(int (* const width)(int), const int * const set, const double seconds) {
+	int64_t passes = 0;
+	int sum = 0;
+	const double start = now();
+	double elapsed;
+	do {
+		for(int i = 0; i < SET_SIZE; i++) sum += width(set[i]);
+		passes++;
+	} while((elapsed = now() - start) < seconds);
+	sink = sum;
+	return elapsed * 1E9 / (passes * SET_SIZE);
+}
+
+int main(int argc, char **argv) {
+	double seconds = .2;
+	const char *locale = "C.UTF-8";
+
+	for(int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-t") && i + 1 < argc) seconds = strtod(argv[++i], NULL);
+		else if (argv[i][0] == '-') {
+			fprintf(stderr, "Usage: widthbench [-t seconds] [locale]\n");
+			return EXIT_FAILURE;
+		}
+		else locale = argv[i];
+	}
+
+	if (!setlocale(LC_ALL, locale)) {
+		fprintf(stderr, "widthbench: cannot set locale %s\n", locale);
+		return EXIT_FAILURE;
+	}
+
+	static const char * const name[] = { "ascii", "latin", "cjk", "bmp", "full" };
+	static int set[SET_SIZE];
+
+	printf("#set\tchars\twcwidth ns/char\tunicode_width ns/char\tratio\tdisagreements\n");
+
+	for(int s = 0; s < sizeof name / sizeof *name; s++) {
+		for(int i = 0; i < SET_SIZE; i++) {
+			switch(s) {
+				case 0: set[i] = ' ' + i % 95; break;
+				case 1: set[i] = 0xA0 + i % 0x1B0; break;
+				case 2: set[i] = 0x4E00 + i % 0x5200; break;
+				case 3: set[i] = rnd(0x10000); break;
+				default: set[i] = rnd(0x110000); break;
+			}
+		}
+
+		int disagreements = 0;
+		for(int i = 0; i < SET_SIZE; i++) disagreements += wcwidth(set[i]) != unicode_width(set[i]);
+
+		const double lib = measure(lib_width, set, seconds), table = measure(table_width, set, seconds);
+		printf("%s\t%d\t%.2f\t%.2f\t%.2f\t%d\n", name[s], SET_SIZE, lib, table, lib / table, disagreements);
+	}
+
+	return EXIT_SUCCESS;
+}